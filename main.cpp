@@ -23,6 +23,21 @@
 #include <functional>
 #include <cstring>
 #include <algorithm>
+#include <cstdio>
+#include <bitset>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <initializer_list>
+#include <filesystem>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 // sound
 #define NOMINMAX
@@ -43,36 +58,168 @@ const char* vertexShaderSrc = R"(
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec2 aTex;
 out vec2 TexCoord;
-uniform mat4 uMVP;
+layout(std140) uniform Frame {
+    mat4 uProjection;
+    mat4 uView;
+};
+uniform mat4 uModel;
+invariant gl_Position; // must match the depth prepass bit for bit
+void main() {
+    gl_Position = uProjection * uView * uModel * vec4(aPos, 1.0);
+    TexCoord = aTex;
+}
+)";
+
+// Depth prepass: same transform as the scene shader, no colour output
+const char* depthVertexShaderSrc = R"(
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(std140) uniform Frame {
+    mat4 uProjection;
+    mat4 uView;
+};
+uniform mat4 uModel;
+invariant gl_Position;
+void main() {
+    gl_Position = uProjection * uView * uModel * vec4(aPos, 1.0);
+}
+)";
+
+const char* depthFragmentShaderSrc = R"(
+#version 330 core
+void main() {
+}
+)";
+
+// Instanced variant for bullets: uModel holds the shared scale, aOffset the
+// per-instance world position streamed each frame
+const char* instancedVertexShaderSrc = R"(
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aTex;
+layout(location = 2) in vec3 aOffset;
+out vec2 TexCoord;
+layout(std140) uniform Frame {
+    mat4 uProjection;
+    mat4 uView;
+};
+uniform mat4 uModel;
+void main() {
+    gl_Position = uProjection * uView * (uModel * vec4(aPos, 1.0) + vec4(aOffset, 0.0));
+    TexCoord = aTex;
+}
+)";
+
+// Enemies: one instance per visible enemy. aEnemy indexes the persistent state
+// in uEnemies, two texels per enemy: (origin, moveStart) and (velocity,
+// smashStart). Position is extrapolated from the last state change, and the
+// smash squash and fade run entirely here.
+const char* enemyVertexShaderSrc = R"(
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aTex;
+layout(location = 3) in uint aEnemy;
+out vec2 TexCoord;
+out float Alpha;
+layout(std140) uniform Frame {
+    mat4 uProjection;
+    mat4 uView;
+    float uTime;
+};
+uniform samplerBuffer uEnemies;
+const float SIZE = 0.35;
+const float SMASH_TIME = 0.5;
 void main() {
-    gl_Position = uMVP * vec4(aPos, 1.0);
+    vec4 origin = texelFetch(uEnemies, int(aEnemy) * 2);
+    vec4 motion = texelFetch(uEnemies, int(aEnemy) * 2 + 1);
+    vec3 center = origin.xyz + motion.xyz * (uTime - origin.w);
+    float t = motion.w < 0.0 ? 0.0 : clamp((uTime - motion.w) / SMASH_TIME, 0.0, 1.0);
+    Alpha = 1.0 - t;
+    gl_Position = uProjection * uView * vec4(center + aPos * vec3(SIZE, SIZE * (1.0 - t), SIZE), 1.0);
     TexCoord = aTex;
 }
 )";
 
+const char* enemyFragmentShaderSrc = R"(
+#version 330 core
+in vec2 TexCoord;
+in float Alpha;
+out vec4 FragColor;
+uniform sampler2DArray uTex;
+uniform int uLayer;
+void main() {
+    FragColor = vec4(texture(uTex, vec3(TexCoord, uLayer)).rgb, Alpha);
+}
+)";
+
+// HUD geometry (gun, crosshair) is already in NDC, so it skips the Frame block
+const char* hudVertexShaderSrc = R"(
+#version 330 core
+layout(location = 0) in vec3 aPos;
+uniform mat4 uModel;
+void main() {
+    gl_Position = uModel * vec4(aPos, 1.0);
+}
+)";
+
+// HUD is untextured, so it gets its own flat-colour fragment shader
+const char* hudFragmentShaderSrc = R"(
+#version 330 core
+out vec4 FragColor;
+uniform vec3 uColor;
+void main() {
+    FragColor = vec4(uColor, 1.0);
+}
+)";
+
 const char* fragmentShaderSrc = R"(
 #version 330 core
 in vec2 TexCoord;
 out vec4 FragColor;
 uniform vec3 uColor;
-uniform sampler2D uTex;
-uniform bool useTex;
+uniform sampler2DArray uTex;
+uniform int uLayer; // texture array layer, -1 for flat colour
 void main() {
-    if(useTex)
-        FragColor = texture(uTex, TexCoord);
+    if(uLayer >= 0)
+        FragColor = texture(uTex, vec3(TexCoord, uLayer));
     else
         FragColor = vec4(uColor, 1.0);
 }
 )";
+// Skybox: rotation-only view, depth pinned to the far plane (z = w) so the
+// sky drawn after the scene with GL_LEQUAL only shades uncovered pixels
+const char* skyVertexShaderSrc = R"(
+#version 330 core
+layout(location = 0) in vec3 aPos;
+out vec3 TexDir;
+layout(std140) uniform Frame {
+    mat4 uProjection;
+    mat4 uView;
+};
+void main() {
+    TexDir = aPos;
+    vec4 pos = uProjection * mat4(mat3(uView)) * vec4(aPos, 1.0);
+    gl_Position = pos.xyww;
+}
+)";
+
+const char* skyFragmentShaderSrc = R"(
+#version 330 core
+in vec3 TexDir;
+out vec4 FragColor;
+uniform samplerCube uTex;
+void main() {
+    FragColor = texture(uTex, TexDir);
+}
+)";
+
 const char* textVertexShaderSrc = R"(
 #version 330 core
 layout(location = 0) in vec2 aPos;
 layout(location = 1) in vec3 aColor;
 out vec3 vColor;
-uniform vec2 uOffset;
-uniform float uScale;
 void main() {
-    gl_Position = vec4((aPos * uScale) + uOffset, 0.0, 1.0);
+    gl_Position = vec4(aPos, 0.0, 1.0); // already placed in NDC by flushText()
     vColor = aColor;
 }
 )";
@@ -86,27 +233,194 @@ void main() {
 }
 )";
 
-// Simple vector struct
-struct Vec3 {
-    float x, y, z;
-    Vec3 operator+(const Vec3& o) const { return {x+o.x, y+o.y, z+o.z}; }
-    Vec3 operator-(const Vec3& o) const { return {x-o.x, y-o.y, z-o.z}; }
-    Vec3 operator*(float s) const { return {x*s, y*s, z*s}; }
+// Uniforms a program may use. Locations are resolved once at link time and
+// stay -1 for uniforms the program does not declare.
+enum Uniform { U_MODEL, U_COLOR, U_LAYER, U_TEX, U_ENEMIES, UNIFORM_COUNT };
+const char* uniformNames[UNIFORM_COUNT] = { "uModel", "uColor", "uLayer", "uTex", "uEnemies" };
+
+struct ShaderProgram {
+    GLuint id = 0;
+    GLint loc[UNIFORM_COUNT];
 };
 
-struct Enemy {
-    Vec3 pos;
-    bool alive = true;
-    glm::vec3 velocity = glm::vec3(0);
-    bool smashing = false;
-    float smashTime = 0.0f;
+// Per-frame data shared by every 3D program through the "Frame" uniform block
+// (std140; programs that do not need uTime may leave it out of their block)
+struct FrameUniforms {
+    glm::mat4 projection;
+    glm::mat4 view;
+    float time;     // simulation seconds
+    float pad[3];
+};
+const GLuint FRAME_UBO_BINDING = 0;
+const GLint ENEMY_STATE_UNIT = 1; // texture unit of the enemy state buffer
+
+// Layers of the scene texture array built by loadTextureArray()
+enum TextureLayer { LAYER_NONE = -1, LAYER_FLOOR, LAYER_WALL, LAYER_ENEMY, LAYER_COUNT };
+const int TEXTURE_ARRAY_SIZE = 256; // every layer is resampled to this square size
+const int SKY_SIZE = 256;           // cube map face size
+
+// Enemies are stored as parallel arrays (structure of arrays) so the per-tick
+// update streams through contiguous floats and can be vectorized. Positions
+// and velocities are in grid units; every enemy floats at ENEMY_Y.
+enum EnemyState : uint8_t { ENEMY_DEAD, ENEMY_ALIVE, ENEMY_SMASHING };
+const float ENEMY_Y = 1.0f;
+
+struct EnemyArrays {
+    std::vector<float> x, z;       // grid position
+    std::vector<float> vx, vz;     // grid cells per second
+    std::vector<float> smashStart; // simTime the smash began
+    std::vector<uint8_t> state;
+    std::vector<uint8_t> bounced;  // scratch for updateEnemies()
+    size_t size() const { return state.size(); }
+};
+
+void clearEnemies(EnemyArrays& en) {
+    en.x.clear(); en.z.clear();
+    en.vx.clear(); en.vz.clear();
+    en.smashStart.clear();
+    en.state.clear();
+    en.bounced.clear();
+}
+
+void addEnemy(EnemyArrays& en, float x, float z, float vx, float vz) {
+    en.x.push_back(x); en.z.push_back(z);
+    en.vx.push_back(vx); en.vz.push_back(vz);
+    en.smashStart.push_back(0.0f);
+    en.state.push_back(ENEMY_ALIVE);
+    en.bounced.push_back(0);
+}
+
+// --- Static geometry ---
+// Every static mesh lives in one vertex buffer and one index buffer under a
+// single VAO. Indices stay relative to their own mesh and are offset with
+// baseVertex at draw time, so switching meshes never rebinds anything.
+struct Mesh {
+    GLuint vao = 0;
+    GLsizei indexCount = 0;
+    GLsizei firstIndex = 0; // into the shared element buffer
+    GLint baseVertex = 0;
 };
 
+struct GeometryRegistry {
+    GLuint vao = 0, vbo = 0, ebo = 0;
+    std::vector<float> vertices; // position + texcoord, 5 floats per vertex
+    std::vector<unsigned int> indices;
+} staticGeometry;
+
+// Append a mesh; vertices with fewer than 5 floats get a zero texcoord.
+// The handle becomes drawable once uploadGeometry() has run.
+Mesh registerMesh(GeometryRegistry& reg, const float* vertices, size_t vertexCount, int floatsPerVertex,
+                  const unsigned int* indices, size_t indexCount) {
+    Mesh mesh;
+    mesh.indexCount = (GLsizei)indexCount;
+    mesh.firstIndex = (GLsizei)reg.indices.size();
+    mesh.baseVertex = (GLint)(reg.vertices.size() / 5);
+    for (size_t v = 0; v < vertexCount; ++v)
+        for (int f = 0; f < 5; ++f)
+            reg.vertices.push_back(f < floatsPerVertex ? vertices[v * floatsPerVertex + f] : 0.0f);
+    reg.indices.insert(reg.indices.end(), indices, indices + indexCount);
+    return mesh;
+}
+
+// Create the shared buffers and fill in the VAO of the given handles
+void uploadGeometry(GeometryRegistry& reg, std::initializer_list<Mesh*> meshes) {
+    glGenVertexArrays(1, &reg.vao);
+    glGenBuffers(1, &reg.vbo);
+    glGenBuffers(1, &reg.ebo);
+    glBindVertexArray(reg.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, reg.vbo);
+    glBufferData(GL_ARRAY_BUFFER, reg.vertices.size() * sizeof(float), reg.vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, reg.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, reg.indices.size() * sizeof(unsigned int), reg.indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0); // position
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float))); // texcoord
+    glEnableVertexAttribArray(1);
+    // Per-instance attributes for instanced draws; enabled once they point at real data
+    glVertexAttribDivisor(2, 1);
+    glVertexAttribDivisor(3, 1); // enemy index
+    glBindVertexArray(0);
+    for (Mesh* mesh : meshes) mesh->vao = reg.vao;
+    // The GPU copy is all that is needed from here on
+    reg.vertices = std::vector<float>();
+    reg.indices = std::vector<unsigned int>();
+}
+
+void destroyGeometry(GeometryRegistry& reg) {
+    glDeleteVertexArrays(1, &reg.vao);
+    glDeleteBuffers(1, &reg.vbo);
+    glDeleteBuffers(1, &reg.ebo);
+    reg = GeometryRegistry();
+}
+
+void drawMesh(const Mesh& mesh, GLenum mode = GL_TRIANGLES) {
+    glDrawElementsBaseVertex(mode, mesh.indexCount, GL_UNSIGNED_INT,
+                             (const void*)(mesh.firstIndex * sizeof(unsigned int)), mesh.baseVertex);
+}
+
 // Maze parameters
 const int MAZE_W = 15, MAZE_H = 15;
 int maze[MAZE_H][MAZE_W] = {1}; // 0 = empty, 1 = wall
 std::vector<glm::vec3> wallPositions;
-std::vector<Enemy> enemies;
+const float CELL_SIZE = 1.5f;   // world units per maze cell (wider path)
+const float WALL_HEIGHT = 2.0f; // walls span y = 0..WALL_HEIGHT
+
+// Walls are baked in square blocks of cells so culling can skip whole blocks
+const int MAZE_BLOCK = 4;
+const int BLOCKS_X = (MAZE_W + MAZE_BLOCK - 1) / MAZE_BLOCK;
+const int BLOCKS_Z = (MAZE_H + MAZE_BLOCK - 1) / MAZE_BLOCK;
+
+struct MazeBlock {
+    GLsizei firstIndex = 0, indexCount = 0; // into the shared element buffer
+    glm::vec3 boundsMin, boundsMax;
+};
+
+// Static mesh for every wall in the maze, baked once by bakeMazeMesh() into
+// the shared static geometry. Blocks are stored row by row
+// (blockZ * BLOCKS_X + blockX), each one a contiguous index range of `mesh`.
+struct MazeMesh {
+    Mesh mesh;
+    MazeBlock blocks[BLOCKS_Z * BLOCKS_X];
+    glm::vec3 rowMin[BLOCKS_Z], rowMax[BLOCKS_Z];
+} mazeMesh;
+
+// Potentially visible set, baked by bakePVS(): pvsCells[from] has a bit for
+// every cell (open or wall) that can be seen from anywhere in cell `from`,
+// pvsBlocks[from] a bit for every wall block containing such a wall cell.
+const int MAZE_CELLS = MAZE_W * MAZE_H;
+std::bitset<MAZE_CELLS> pvsCells[MAZE_CELLS];
+std::bitset<BLOCKS_X * BLOCKS_Z> pvsBlocks[MAZE_CELLS];
+EnemyArrays enemies;
+int enemySpawnCount = 10; // --enemies N
+void markEnemyChanged(size_t index);
+
+// Non-dead enemies binned by maze cell, rebuilt every tick by binEnemies():
+// the enemies in cell c are indices[cellStart[c] .. cellStart[c + 1]).
+struct EnemyGrid {
+    int cellStart[MAZE_CELLS + 1] = {};
+    std::vector<int> indices;
+    std::vector<int> cellOf; // scratch: cell of each enemy, -1 if dead
+} enemyGrid;
+
+// Counting sort over the cells, so the bins stay contiguous with no per-cell allocations
+void binEnemies(EnemyGrid& grid, const EnemyArrays& en) {
+    std::fill(std::begin(grid.cellStart), std::end(grid.cellStart), 0);
+    grid.cellOf.resize(en.size());
+    for (size_t i = 0; i < en.size(); ++i) {
+        grid.cellOf[i] = -1;
+        if (en.state[i] == ENEMY_DEAD) continue;
+        int cx = std::clamp(int(std::round(en.x[i])), 0, MAZE_W - 1);
+        int cz = std::clamp(int(std::round(en.z[i])), 0, MAZE_H - 1);
+        grid.cellOf[i] = cz * MAZE_W + cx;
+        grid.cellStart[grid.cellOf[i] + 1]++;
+    }
+    for (int c = 0; c < MAZE_CELLS; ++c) grid.cellStart[c + 1] += grid.cellStart[c];
+    grid.indices.resize(grid.cellStart[MAZE_CELLS]);
+    int fill[MAZE_CELLS];
+    std::copy(grid.cellStart, grid.cellStart + MAZE_CELLS, fill);
+    for (size_t i = 0; i < en.size(); ++i)
+        if (grid.cellOf[i] >= 0) grid.indices[fill[grid.cellOf[i]]++] = int(i);
+}
 
 // Camera and player state
 float yaw = -90.0f, pitch = 0.0f;
@@ -117,6 +431,11 @@ float lastX = 400, lastY = 300;
 bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+float simRate = 120.0f; // simulation ticks per second, --tick-rate
+uint32_t simTick = 0; // ticks simulated so far
+float simTime = 0.0f; // simulated seconds, advanced in fixed ticks; drives GPU-side animation
+glm::vec3 prevCamPos = camPos; // camPos before the last tick, for render interpolation
+glm::vec3 moveInput = glm::vec3(0.0f); // WASD direction from process_input, applied each tick
 float camYVelocity = 0.0f;
 bool isJumping = false;
 // Player collision radius (XZ plane)
@@ -124,11 +443,28 @@ const float PLAYER_RADIUS = 0.25f;
 
 struct Bullet {
     glm::vec3 pos;
+    glm::vec3 prevPos; // before the last tick, for render interpolation
     glm::vec3 dir;
     float speed;
-    bool alive = true;
 };
-std::vector<Bullet> bullets;
+
+// Fixed-capacity pool; live bullets are packed in [0, count) and removed by
+// swapping the last one into the hole, so loops only ever touch live entries.
+const size_t MAX_BULLETS = 256;
+struct BulletPool {
+    Bullet items[MAX_BULLETS];
+    size_t count = 0;
+} bullets;
+
+// Returns nullptr when the pool is full
+Bullet* spawnBullet(BulletPool& pool) {
+    if (pool.count == MAX_BULLETS) return nullptr;
+    return &pool.items[pool.count++];
+}
+
+void removeBullet(BulletPool& pool, size_t i) {
+    pool.items[i] = pool.items[--pool.count];
+}
 
 struct GameParameters {
     float playerSpeed = 5.0f;
@@ -138,6 +474,9 @@ struct GameParameters {
     glm::vec3 enemyColor = glm::vec3(1,0,0);
     float wallHeight = 2.0f;
     bool showDebug = true;
+    bool depthPrepass = false; // F1 toggles
+    bool dynamicResolution = false; // F2 toggles
+    bool occlusionQueries = false;  // F3 toggles
 } params;
 
 float cubeVertices[] = {
@@ -207,6 +546,17 @@ unsigned int gunIndices[] = {
     0,1,2, 2,3,0
 };
 
+// Crosshair (2D, NDC space), drawn as two lines
+float crosshairVertices[] = {
+    -0.03f,  0.0f, 0.0f,
+     0.03f,  0.0f, 0.0f,
+     0.0f, -0.03f, 0.0f,
+     0.0f,  0.03f, 0.0f
+};
+unsigned int crosshairIndices[] = {
+    0,1, 2,3
+};
+
 void generateMaze() {
     // memset(maze, 1, sizeof(maze));
     for (int y = 0; y < MAZE_H; ++y)
@@ -240,9 +590,128 @@ void buildWalls() {
 //     std::cout << "2" << std::endl;
 }
 
+bool isWall(int x, int y) {
+    return x >= 0 && x < MAZE_W && y >= 0 && y < MAZE_H && maze[y][x] == 1;
+}
+
+// Append a quad given its corners counter-clockwise as seen from outside
+// (bottom-left, bottom-right, top-right, top-left). UVs repeat once per cell.
+void addQuad(std::vector<float>& verts, std::vector<unsigned int>& indices,
+             glm::vec3 bl, glm::vec3 br, glm::vec3 tr, glm::vec3 tl, float uLen, float vLen) {
+    unsigned int base = (unsigned int)(verts.size() / 5);
+    const glm::vec3 corners[4] = {bl, br, tr, tl};
+    const float uvs[4][2] = {{0, 0}, {uLen, 0}, {uLen, vLen}, {0, vLen}};
+    for (int i = 0; i < 4; ++i) {
+        verts.insert(verts.end(), {corners[i].x, corners[i].y, corners[i].z, uvs[i][0], uvs[i][1]});
+    }
+    indices.insert(indices.end(), {base, base+1, base+2, base+2, base+3, base});
+}
+
+glm::vec3 gridToWorld(float gx, float y, float gz) {
+    return glm::vec3(gx * CELL_SIZE - 10.5f, y, gz * CELL_SIZE - 10.5f);
+}
+
+// --- Bake all walls into one mesh ---
+// Faces shared by two wall cells are never visible and are skipped. Remaining
+// side faces are merged along runs of cells, and tops are merged greedily into
+// rectangles, so a dense maze needs a few hundred quads instead of 6 per cell.
+// Bottoms sit on the floor and are dropped. Merging stops at block edges.
+void bakeMazeBlock(int bx0, int bz0, int bx1, int bz1,
+                   std::vector<float>& verts, std::vector<unsigned int>& indices) {
+    const float half = CELL_SIZE * 0.5f;
+    auto minX = [&](int x) { return x * CELL_SIZE - 10.5f - half; };
+    auto minZ = [&](int y) { return y * CELL_SIZE - 10.5f - half; };
+    const float h = WALL_HEIGHT;
+
+    // Side faces facing +X/-X: merge runs along Z
+    for (int side = -1; side <= 1; side += 2) {
+        for (int x = bx0; x < bx1; ++x) {
+            int y = bz0;
+            while (y < bz1) {
+                if (!isWall(x, y) || isWall(x + side, y)) { ++y; continue; }
+                int y0 = y;
+                while (y < bz1 && isWall(x, y) && !isWall(x + side, y)) ++y;
+                float fx = side > 0 ? minX(x) + CELL_SIZE : minX(x);
+                float z0 = minZ(y0), z1 = minZ(y - 1) + CELL_SIZE;
+                float runs = float(y - y0);
+                if (side > 0)
+                    addQuad(verts, indices, {fx, 0, z1}, {fx, 0, z0}, {fx, h, z0}, {fx, h, z1}, runs, 1.0f);
+                else
+                    addQuad(verts, indices, {fx, 0, z0}, {fx, 0, z1}, {fx, h, z1}, {fx, h, z0}, runs, 1.0f);
+            }
+        }
+    }
+    // Side faces facing +Z/-Z: merge runs along X
+    for (int side = -1; side <= 1; side += 2) {
+        for (int y = bz0; y < bz1; ++y) {
+            int x = bx0;
+            while (x < bx1) {
+                if (!isWall(x, y) || isWall(x, y + side)) { ++x; continue; }
+                int x0 = x;
+                while (x < bx1 && isWall(x, y) && !isWall(x, y + side)) ++x;
+                float fz = side > 0 ? minZ(y) + CELL_SIZE : minZ(y);
+                float x0w = minX(x0), x1w = minX(x - 1) + CELL_SIZE;
+                float runs = float(x - x0);
+                if (side > 0)
+                    addQuad(verts, indices, {x0w, 0, fz}, {x1w, 0, fz}, {x1w, h, fz}, {x0w, h, fz}, runs, 1.0f);
+                else
+                    addQuad(verts, indices, {x1w, 0, fz}, {x0w, 0, fz}, {x0w, h, fz}, {x1w, h, fz}, runs, 1.0f);
+            }
+        }
+    }
+    // Tops: greedy rectangles over the wall cells
+    bool used[MAZE_BLOCK][MAZE_BLOCK] = {};
+    auto unmerged = [&](int x, int y) { return isWall(x, y) && !used[y - bz0][x - bx0]; };
+    for (int y = bz0; y < bz1; ++y) {
+        for (int x = bx0; x < bx1; ++x) {
+            if (!unmerged(x, y)) continue;
+            int w = 1;
+            while (x + w < bx1 && unmerged(x + w, y)) ++w;
+            int d = 1;
+            for (bool grow = true; grow && y + d < bz1; ) {
+                for (int i = 0; i < w; ++i)
+                    if (!unmerged(x + i, y + d)) { grow = false; break; }
+                if (grow) ++d;
+            }
+            for (int j = 0; j < d; ++j)
+                for (int i = 0; i < w; ++i)
+                    used[y + j - bz0][x + i - bx0] = true;
+            float x0w = minX(x), x1w = minX(x + w - 1) + CELL_SIZE;
+            float z0 = minZ(y), z1 = minZ(y + d - 1) + CELL_SIZE;
+            addQuad(verts, indices, {x0w, h, z1}, {x1w, h, z1}, {x1w, h, z0}, {x0w, h, z0}, float(w), float(d));
+        }
+    }
+}
+
+// Registers the walls with `reg`; must run before uploadGeometry()
+void bakeMazeMesh(GeometryRegistry& reg) {
+    std::vector<float> verts;
+    std::vector<unsigned int> indices;
+    const float half = CELL_SIZE * 0.5f;
+    for (int bz = 0; bz < BLOCKS_Z; ++bz) {
+        int z0 = bz * MAZE_BLOCK, z1 = std::min(z0 + MAZE_BLOCK, MAZE_H);
+        for (int bx = 0; bx < BLOCKS_X; ++bx) {
+            int x0 = bx * MAZE_BLOCK, x1 = std::min(x0 + MAZE_BLOCK, MAZE_W);
+            MazeBlock& block = mazeMesh.blocks[bz * BLOCKS_X + bx];
+            block.firstIndex = (GLsizei)indices.size();
+            bakeMazeBlock(x0, z0, x1, z1, verts, indices);
+            block.indexCount = (GLsizei)indices.size() - block.firstIndex;
+            block.boundsMin = gridToWorld(float(x0), 0.0f, float(z0)) - glm::vec3(half, 0, half);
+            block.boundsMax = gridToWorld(float(x1 - 1), WALL_HEIGHT, float(z1 - 1)) + glm::vec3(half, 0, half);
+        }
+        mazeMesh.rowMin[bz] = mazeMesh.blocks[bz * BLOCKS_X].boundsMin;
+        mazeMesh.rowMax[bz] = mazeMesh.blocks[bz * BLOCKS_X + BLOCKS_X - 1].boundsMax;
+    }
+
+    mazeMesh.mesh = registerMesh(reg, verts.data(), verts.size() / 5, 5, indices.data(), indices.size());
+    for (MazeBlock& block : mazeMesh.blocks) block.firstIndex += mazeMesh.mesh.firstIndex;
+    std::cout << "Maze mesh: " << indices.size() / 6 << " quads, " << verts.size() / 5
+              << " vertices (was " << wallPositions.size() * 24 << ")" << std::endl;
+}
+
 // --- Place enemies in open cells ---
 void spawnEnemies() {
-    enemies.clear();
+    clearEnemies(enemies);
     std::vector<std::pair<int, int>> emptyCells;
     for (int y = 0; y < MAZE_H; ++y)
         for (int x = 0; x < MAZE_W; ++x)
@@ -252,14 +721,16 @@ void spawnEnemies() {
     std::mt19937 rng((unsigned int)time(0));
     std::shuffle(emptyCells.begin(), emptyCells.end(), rng);
 
-    int numEnemies = std::min(10, (int)emptyCells.size());
+    // More enemies than open cells share cells
+    int numEnemies = emptyCells.empty() ? 0 : enemySpawnCount;
     for (int i = 0; i < numEnemies; ++i) {
-        int x = emptyCells[i].first;
-        int y = emptyCells[i].second;
+        int x = emptyCells[i % emptyCells.size()].first;
+        int y = emptyCells[i % emptyCells.size()].second;
         float vx = (rng() % 2 - 0.5f) * 2.0f, vz = (rng() % 2 - 0.5f) * 2.0f;
-        // enemies.push_back({Vec3{float((x - 7)*1.5f), 1, float((y - 7)*1.5f)}, true, glm::vec3(vx, 0, vz)});
-        enemies.push_back({Vec3{float(x), 1, float(y)}, true, glm::vec3(vx, 0, vz)});
+        addEnemy(enemies, float(x), float(y), vx, vz);
+        markEnemyChanged(enemies.size() - 1);
     }
+    binEnemies(enemyGrid, enemies);
     // std::cout << "3" << std::endl;
 }
 
@@ -277,30 +748,135 @@ GLuint compileShader(GLenum type, const char* src) {
     return shader;
 }
 
-GLuint createShaderProgram() {
-    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexShaderSrc);
-    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSrc);
-    GLuint prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
-    glLinkProgram(prog);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-    return prog;
+bool checkLinkStatus(GLuint program) {
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char info[512];
+        glGetProgramInfoLog(program, 512, nullptr, info);
+        std::cerr << "Program link error: " << info << std::endl;
+    }
+    return success;
+}
+
+// --- Program binary cache ---
+// Linked programs are stored under shader_cache/ keyed by a hash of both
+// sources and the driver strings, so a driver update or shader edit misses
+// the cache instead of loading a stale binary. Needs GL 4.1 or
+// ARB_get_program_binary; otherwise every launch compiles from source.
+const char* SHADER_CACHE_DIR = "shader_cache";
+
+uint64_t fnv1a(const char* str, uint64_t hash = 14695981039346656037ull) {
+    for (; *str; ++str) hash = (hash ^ (unsigned char)*str) * 1099511628211ull;
+    return hash;
+}
+
+bool programBinarySupported() {
+    if (!glGetProgramBinary || !glProgramBinary) return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+std::string programCachePath(const char* vsSrc, const char* fsSrc) {
+    uint64_t hash = fnv1a(vsSrc);
+    hash = fnv1a(fsSrc, hash);
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        hash = fnv1a((const char*)glGetString(name), hash);
+    char file[32];
+    snprintf(file, sizeof(file), "%016llx.bin", (unsigned long long)hash);
+    return std::string(SHADER_CACHE_DIR) + "/" + file;
 }
 
-GLuint createTextShaderProgram() {
-    GLuint vs = compileShader(GL_VERTEX_SHADER, textVertexShaderSrc);
-    GLuint fs = compileShader(GL_FRAGMENT_SHADER, textFragmentShaderSrc);
-    GLuint prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
-    glLinkProgram(prog);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+bool loadProgramBinary(GLuint program, const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    GLenum format = 0;
+    if (!in.read((char*)&format, sizeof(format))) return false;
+    std::vector<char> binary((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    glProgramBinary(program, format, binary.data(), (GLsizei)binary.size());
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success; // rejected binaries (e.g. after a driver change) fall back to source
+}
+
+void saveProgramBinary(GLuint program, const std::string& path) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+    std::error_code ec;
+    std::filesystem::create_directories(SHADER_CACHE_DIR, ec);
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char*)&format, sizeof(format));
+    out.write(binary.data(), binary.size());
+    if (!out) std::cerr << "Failed to write program cache: " << path << std::endl;
+}
+
+// Link a program and resolve everything drawObject() and friends need up front
+ShaderProgram createProgram(const char* vsSrc, const char* fsSrc) {
+    ShaderProgram prog;
+    prog.id = glCreateProgram();
+    const bool cacheable = programBinarySupported();
+    std::string cachePath = cacheable ? programCachePath(vsSrc, fsSrc) : std::string();
+    if (!cacheable || !loadProgramBinary(prog.id, cachePath)) {
+        GLuint vs = compileShader(GL_VERTEX_SHADER, vsSrc);
+        GLuint fs = compileShader(GL_FRAGMENT_SHADER, fsSrc);
+        glAttachShader(prog.id, vs);
+        glAttachShader(prog.id, fs);
+        if (cacheable) glProgramParameteri(prog.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(prog.id);
+        glDetachShader(prog.id, vs);
+        glDetachShader(prog.id, fs);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        if (checkLinkStatus(prog.id) && cacheable) saveProgramBinary(prog.id, cachePath);
+    }
+
+    for (int i = 0; i < UNIFORM_COUNT; ++i)
+        prog.loc[i] = glGetUniformLocation(prog.id, uniformNames[i]);
+    GLuint frameBlock = glGetUniformBlockIndex(prog.id, "Frame");
+    if (frameBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(prog.id, frameBlock, FRAME_UBO_BINDING);
+    // Samplers have fixed units: scene textures on 0, enemy state on 1
+    if (prog.loc[U_TEX] != -1 || prog.loc[U_ENEMIES] != -1) {
+        glUseProgram(prog.id);
+        glUniform1i(prog.loc[U_TEX], 0);
+        glUniform1i(prog.loc[U_ENEMIES], ENEMY_STATE_UNIT);
+        glUseProgram(0);
+    }
     return prog;
 }
 
+ShaderProgram createShaderProgram() {
+    return createProgram(vertexShaderSrc, fragmentShaderSrc);
+}
+
+ShaderProgram createEnemyShaderProgram() {
+    return createProgram(enemyVertexShaderSrc, enemyFragmentShaderSrc);
+}
+
+ShaderProgram createDepthShaderProgram() {
+    return createProgram(depthVertexShaderSrc, depthFragmentShaderSrc);
+}
+
+ShaderProgram createInstancedShaderProgram() {
+    return createProgram(instancedVertexShaderSrc, fragmentShaderSrc);
+}
+
+ShaderProgram createHudShaderProgram() {
+    return createProgram(hudVertexShaderSrc, hudFragmentShaderSrc);
+}
+
+ShaderProgram createSkyShaderProgram() {
+    return createProgram(skyVertexShaderSrc, skyFragmentShaderSrc);
+}
+
+ShaderProgram createTextShaderProgram() {
+    return createProgram(textVertexShaderSrc, textFragmentShaderSrc);
+}
+
 // Framebuffer resize callback to handle HiDPI / scaling
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     // Make sure the viewport matches the new framebuffer size
@@ -308,6 +884,8 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 }
 
 
+void updateCamFront();
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     if (firstMouse) {
         lastX = (float)xpos;
@@ -329,6 +907,10 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     if (pitch > 89.0f) pitch = 89.0f;
     if (pitch < -89.0f) pitch = -89.0f;
 
+    updateCamFront();
+}
+
+void updateCamFront() {
     glm::vec3 dir;
     dir.x = cosf(glm::radians(yaw)) * cosf(glm::radians(pitch));
     dir.y = sinf(glm::radians(pitch));
@@ -337,66 +919,56 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
 }
 
 // --- Player movement and collision ---
+// Outside the maze counts as solid for the player
+bool isBlocked(int x, int z) {
+    return x < 0 || x >= MAZE_W || z < 0 || z >= MAZE_H || maze[z][x] == 1;
+}
+
+int worldToCell(float w) {
+    return int(std::round(w / CELL_SIZE + 7));
+}
+
+// Swept player movement along one axis. The player's footprint is its
+// bounding square (half-size PLAYER_RADIUS plus a skin), which contains the
+// collision circle. Every cell the leading edge would cross is checked in
+// order, so a step of any length stops at the first wall instead of
+// tunnelling through it. `across` is the other coordinate, held fixed.
+float sweepAxis(float from, float delta, float across, bool alongX) {
+    if (delta == 0.0f) return from;
+    const float r = PLAYER_RADIUS + 0.01f;
+    const int dir = delta > 0.0f ? 1 : -1;
+    const int acrossLo = worldToCell(across - r), acrossHi = worldToCell(across + r);
+    const float lead = from + dir * r;
+    const int last = worldToCell(lead + delta);
+    for (int c = worldToCell(lead) + dir; dir > 0 ? c <= last : c >= last; c += dir) {
+        for (int k = acrossLo; k <= acrossHi; ++k) {
+            if (!(alongX ? isBlocked(c, k) : isBlocked(k, c))) continue;
+            float face = (c - 7) * CELL_SIZE - dir * CELL_SIZE * 0.5f; // near side of cell c
+            float stop = face - dir * (r + 0.001f);
+            return dir > 0 ? std::max(from, stop) : std::min(from, stop);
+        }
+    }
+    return from + delta;
+}
+
+// Move X then Z: hitting a wall on one axis keeps the other component, so the
+// player slides along walls
+void movePlayer(glm::vec3& pos, glm::vec3 step) {
+    pos.x = sweepAxis(pos.x, step.x, pos.z, true);
+    pos.z = sweepAxis(pos.z, step.z, pos.x, false);
+    pos.y += step.y;
+}
+
 void process_input(GLFWwindow* window) {
-    float speed = 5.0f * deltaTime;
-    glm::vec3 nextPos = camPos;
     glm::vec3 flatFront = glm::normalize(glm::vec3(camFront.x, 0, camFront.z)); // Ignore Y for movement
     glm::vec3 right = glm::normalize(glm::cross(flatFront, camUp));
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) nextPos += flatFront * speed;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) nextPos -= flatFront * speed;
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) nextPos -= right * speed;
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) nextPos += right * speed;
+    moveInput = glm::vec3(0.0f);
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) moveInput += flatFront;
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) moveInput -= flatFront;
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) moveInput -= right;
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) moveInput += right;
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
     if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) spawnEnemies();
-    // Prevent going below ground
-    if (nextPos.y < 1.6f) nextPos.y = 1.6f;
-
-    // Maze collision: perform cylinder (player) vs AABB (wall) collision on XZ plane
-    // Wall positions are centered at wallPositions with spacing ~1.5. Use a half-size matching wall drawn size.
-    float wallHalfSize = 0.75f; // half-extent of wall in X/Z (tweak if needed)
-    glm::vec3 resolvedPos = nextPos;
-    for (const auto &wp : wallPositions) {
-        // AABB min/max on XZ
-        float minX = wp.x - wallHalfSize;
-        float maxX = wp.x + wallHalfSize;
-        float minZ = wp.z - wallHalfSize;
-        float maxZ = wp.z + wallHalfSize;
-
-        // Closest point on AABB to player's XZ
-        float closestX = std::max(minX, std::min(resolvedPos.x, maxX));
-        float closestZ = std::max(minZ, std::min(resolvedPos.z, maxZ));
-
-        float dx = resolvedPos.x - closestX;
-        float dz = resolvedPos.z - closestZ;
-        float dist2 = dx*dx + dz*dz;
-
-        float minDist = PLAYER_RADIUS + 0.01f; // small epsilon
-        if (dist2 < minDist * minDist) {
-            float dist = std::sqrt(dist2);
-            // If we're exactly inside (dist==0), push out along camera forward direction
-            float nx = 0.0f, nz = 0.0f;
-            if (dist > 0.0001f) {
-                nx = dx / dist;
-                nz = dz / dist;
-            } else {
-                // fallback direction: from wall center to player previous position
-                float fx = resolvedPos.x - wp.x;
-                float fz = resolvedPos.z - wp.z;
-                float flen = std::sqrt(fx*fx + fz*fz);
-                if (flen > 0.0001f) { nx = fx / flen; nz = fz / flen; }
-                else { nx = 1.0f; nz = 0.0f; }
-            }
-            // push player out so distance equals minDist
-            resolvedPos.x = closestX + nx * minDist;
-            resolvedPos.z = closestZ + nz * minDist;
-        }
-    }
-
-    // Now check map bounds and cell openness before applying resolvedPos
-    int px = int(std::round(resolvedPos.x/1.5f+7)), pz = int(std::round(resolvedPos.z/1.5f+7));
-    if (px>=0 && px<MAZE_W && pz>=0 && pz<MAZE_H && maze[pz][px]==0)
-        camPos = resolvedPos;
-    
 
     if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !isJumping) {
         camYVelocity = 6.0f; // jump strength
@@ -411,6 +983,30 @@ void process_input(GLFWwindow* window) {
         lastToggle = now;
     }
 }
+    if (glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS) {
+        static double lastPrepassToggle = 0.0;
+        double now = glfwGetTime();
+        if (now - lastPrepassToggle > 0.3) {
+            params.depthPrepass = !params.depthPrepass;
+            lastPrepassToggle = now;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS) {
+        static double lastResToggle = 0.0;
+        double now = glfwGetTime();
+        if (now - lastResToggle > 0.3) {
+            params.dynamicResolution = !params.dynamicResolution;
+            lastResToggle = now;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS) {
+        static double lastOcclusionToggle = 0.0;
+        double now = glfwGetTime();
+        if (now - lastOcclusionToggle > 0.3) {
+            params.occlusionQueries = !params.occlusionQueries;
+            lastOcclusionToggle = now;
+        }
+    }
 }
 // --- Ray-box intersection for shooting ---
 bool rayIntersectsAABB(
@@ -461,128 +1057,1057 @@ void shoot() {
     system("aplay assets/shoot.wav &");
 #endif
 
- // Spawn a bullet at camera position, in camera direction
-    Bullet b;
-    b.pos = camPos + glm::vec3(0, -0.1f, 0); // Slightly below eye
-    b.dir = glm::normalize(camFront);
-    b.speed = 18.0f;
-    b.alive = true;
-    bullets.push_back(b);
+ // Spawn a bullet at camera position, in camera direction (skipped if the pool is full)
+    if (Bullet* b = spawnBullet(bullets)) {
+        b->pos = camPos + glm::vec3(0, -0.1f, 0); // Slightly below eye
+        b->prevPos = b->pos;
+        b->dir = glm::normalize(camFront);
+        b->speed = 18.0f;
+    }
 
-    float closestT = 1e9f;
-    Enemy* hitEnemy = nullptr;
+    // Walk the ray through the maze cells in order (Amanatides-Woo DDA).
+    // t is world distance along the ray; tEnter/tExit bound the part of the
+    // ray inside the current cell. An enemy box (half-size 0.175) can reach
+    // into the next cell, so each step tests the 3x3 bins around the cell and
+    // stops as soon as the closest hit lies within the current cell.
+    const float range = 100.0f;
     glm::vec3 rayOrigin = camPos;
     glm::vec3 rayDir = glm::normalize(camFront);
+    int cx = worldToCell(rayOrigin.x), cz = worldToCell(rayOrigin.z);
+    const int stepX = rayDir.x > 0.0f ? 1 : -1, stepZ = rayDir.z > 0.0f ? 1 : -1;
+    auto firstCrossing = [](float origin, float dir, int cell, int step) {
+        if (dir == 0.0f) return 1e9f;
+        float boundary = (cell - 7) * CELL_SIZE + step * CELL_SIZE * 0.5f;
+        return (boundary - origin) / dir;
+    };
+    float tMaxX = firstCrossing(rayOrigin.x, rayDir.x, cx, stepX);
+    float tMaxZ = firstCrossing(rayOrigin.z, rayDir.z, cz, stepZ);
+    const float tDeltaX = rayDir.x != 0.0f ? CELL_SIZE / std::abs(rayDir.x) : 1e9f;
+    const float tDeltaZ = rayDir.z != 0.0f ? CELL_SIZE / std::abs(rayDir.z) : 1e9f;
+
+    float closestT = 1e9f;
+    int hitEnemy = -1;
+    float tEnter = 0.0f;
+    bool blocked = false;
+    while (tEnter < range) {
+        // Walls (and the outside) stop the shot unless it passes over them;
+        // once it is above the walls and rising there is nothing left to hit
+        const float tExit = std::min(tMaxX, tMaxZ);
+        const float y = rayOrigin.y + rayDir.y * tEnter;
+        const float yLow = std::min(y, rayOrigin.y + rayDir.y * tExit); // lowest point inside the cell
+        if (isBlocked(cx, cz) && yLow <= WALL_HEIGHT) { blocked = true; break; }
+        if (y > WALL_HEIGHT && rayDir.y >= 0.0f) break;
+
+        for (int nz = std::max(cz - 1, 0); nz <= std::min(cz + 1, MAZE_H - 1); ++nz)
+        for (int nx = std::max(cx - 1, 0); nx <= std::min(cx + 1, MAZE_W - 1); ++nx) {
+            const int c = nz * MAZE_W + nx;
+            for (int k = enemyGrid.cellStart[c]; k < enemyGrid.cellStart[c + 1]; ++k) {
+                const int i = enemyGrid.indices[k];
+                if (enemies.state[i] == ENEMY_DEAD) continue;
+                float tHit;
+                // Use world coordinates for the enemy's box center
+                glm::vec3 enemyWorldPos = gridToWorld(enemies.x[i], ENEMY_Y, enemies.z[i]);
+                if (rayIntersectsAABB(rayOrigin, rayDir, enemyWorldPos, 0.175f, tHit)) { // 0.175f matches enemy's half-size
+                    if (tHit > 0.0f && tHit < closestT && tHit < range) {
+                        closestT = tHit;
+                        hitEnemy = i;
+                    }
+                }
+            }
+        }
+        if (closestT <= tExit) break;
+
+        tEnter = tExit;
+        if (tMaxX < tMaxZ) { cx += stepX; tMaxX += tDeltaX; }
+        else               { cz += stepZ; tMaxZ += tDeltaZ; }
+    }
+    // A box found from a neighbouring bin may only be reached behind the wall
+    if (blocked && closestT > tEnter) hitEnemy = -1;
+    if (hitEnemy >= 0) {
+        enemies.state[hitEnemy] = ENEMY_DEAD;
+        std::cout << "Enemy hit!\n";
+    }
+}
+
+// Bilinear resample of an RGB8 image to size x size (layers of an array must match)
+std::vector<unsigned char> resampleRGB(const unsigned char* src, int w, int h, int size) {
+    std::vector<unsigned char> dst(size * size * 3);
+    for (int y = 0; y < size; ++y) {
+        float fy = std::max(0.0f, (y + 0.5f) * h / size - 0.5f);
+        int y0 = std::min((int)fy, h - 1), y1 = std::min(y0 + 1, h - 1);
+        float ty = fy - y0;
+        for (int x = 0; x < size; ++x) {
+            float fx = std::max(0.0f, (x + 0.5f) * w / size - 0.5f);
+            int x0 = std::min((int)fx, w - 1), x1 = std::min(x0 + 1, w - 1);
+            float tx = fx - x0;
+            for (int c = 0; c < 3; ++c) {
+                float top = src[(y0 * w + x0) * 3 + c] * (1 - tx) + src[(y0 * w + x1) * 3 + c] * tx;
+                float bottom = src[(y1 * w + x0) * 3 + c] * (1 - tx) + src[(y1 * w + x1) * 3 + c] * tx;
+                dst[(y * size + x) * 3 + c] = (unsigned char)(top * (1 - ty) + bottom * ty + 0.5f);
+            }
+        }
+    }
+    return dst;
+}
+
+// --- Texture cooking ---
+// Decoding JPEGs, resampling and building mips is done once per image and the
+// result kept in texture_cache/. A cache file holds the finished mip chain,
+// DXT1-compressed when the driver has S3TC, and is rebuilt when the source
+// file changes or --cook-assets is passed.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+const char* TEXTURE_CACHE_DIR = "texture_cache";
+const uint32_t COOKED_MAGIC = 0x31585446; // "FTX1"
+const uint32_t COOKED_VERSION = 1;        // bump when the cooker's output changes
+bool cookAssets = false; // --cook-assets: ignore existing cache files
+
+// Written to disk as is, so every byte is a named field: no padding to leak
+struct CookedHeader {
+    uint32_t magic = COOKED_MAGIC;
+    uint32_t version = COOKED_VERSION;
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    int32_t size = 0;        // requested square size
+    int32_t mips = 0;        // requested full mip chain
+    int32_t compress = 0;    // requested DXT1
+    uint32_t format = 0;     // what was actually stored
+    int32_t levels = 0;
+    int32_t reserved = 0;
+};
+static_assert(sizeof(CookedHeader) == 48, "CookedHeader must have no padding");
+
+struct CookedTexture {
+    GLenum format = GL_RGB8;
+    int size = 0;
+    std::vector<std::vector<unsigned char>> levels; // level 0 first
+};
+
+bool hasGLExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
+    return false;
+}
 
-    for (auto& e : enemies) {
-        if (!e.alive) continue;
-        float tHit;
-        // Use world coordinates for the enemy's box center
-glm::vec3 enemyWorldPos = glm::vec3(e.pos.x * 1.5f - 10.5f, e.pos.y, e.pos.z * 1.5f - 10.5f);
-if (rayIntersectsAABB(rayOrigin, rayDir, enemyWorldPos, 0.175f, tHit)) // 0.175f matches enemy's half-size
+// 2x2 box filter down to the next mip level
+std::vector<unsigned char> downsampleRGB(const std::vector<unsigned char>& src, int size) {
+    int half = std::max(1, size / 2);
+    std::vector<unsigned char> dst(half * half * 3);
+    for (int y = 0; y < half; ++y)
+        for (int x = 0; x < half; ++x)
+            for (int c = 0; c < 3; ++c) {
+                int x0 = x * 2, y0 = y * 2;
+                int x1 = std::min(x0 + 1, size - 1), y1 = std::min(y0 + 1, size - 1);
+                int sum = src[(y0 * size + x0) * 3 + c] + src[(y0 * size + x1) * 3 + c] +
+                          src[(y1 * size + x0) * 3 + c] + src[(y1 * size + x1) * 3 + c];
+                dst[(y * half + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+            }
+    return dst;
+}
+
+uint16_t packRGB565(const int rgb[3]) {
+    return uint16_t(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+}
 
-       {
+void unpackRGB565(uint16_t c, int rgb[3]) {
+    rgb[0] = ((c >> 11) & 31) * 255 / 31;
+    rgb[1] = ((c >> 5) & 63) * 255 / 63;
+    rgb[2] = (c & 31) * 255 / 31;
+}
 
-           if (tHit > 0.0f && tHit < closestT && tHit < 100.0f) {
-                closestT = tHit;
-                hitEnemy = &e;
+// One 4x4 block: endpoints from the inset bounding box of the block's colours,
+// each pixel gets the nearest of the four palette entries. Endpoints are ordered
+// c0 > c1 so the block stays in opaque four-colour mode.
+void encodeDXT1Block(const unsigned char pixels[16][3], unsigned char out[8]) {
+    int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c) {
+            lo[c] = std::min(lo[c], (int)pixels[i][c]);
+            hi[c] = std::max(hi[c], (int)pixels[i][c]);
+        }
+    for (int c = 0; c < 3; ++c) {
+        int inset = (hi[c] - lo[c]) / 16;
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+    // Use the box diagonal that follows the colours: flip channels that fall
+    // while the widest channel rises
+    int axis = 0, mean[3] = {0, 0, 0};
+    for (int c = 0; c < 3; ++c) {
+        if (hi[c] - lo[c] > hi[axis] - lo[axis]) axis = c;
+        for (int i = 0; i < 16; ++i) mean[c] += pixels[i][c];
+        mean[c] /= 16;
+    }
+    for (int c = 0; c < 3; ++c) {
+        int cov = 0;
+        for (int i = 0; i < 16; ++i) cov += (pixels[i][axis] - mean[axis]) * (pixels[i][c] - mean[c]);
+        if (cov < 0) std::swap(lo[c], hi[c]);
+    }
+    uint16_t c0 = packRGB565(hi), c1 = packRGB565(lo);
+    if (c0 < c1) std::swap(c0, c1);
+    int palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDist = INT32_MAX;
+            for (int p = 0; p < 4; ++p) {
+                int dr = pixels[i][0] - palette[p][0], dg = pixels[i][1] - palette[p][1], db = pixels[i][2] - palette[p][2];
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < bestDist) { bestDist = dist; best = p; }
             }
+            indices |= uint32_t(best) << (i * 2);
         }
     }
-    if (hitEnemy) {
-        hitEnemy->alive = false;
-        std::cout << "Enemy hit!\n";
+    out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+    for (int b = 0; b < 4; ++b) out[4 + b] = (indices >> (b * 8)) & 0xFF;
+}
+
+// Levels below 4x4 still take a whole block; edge pixels are repeated
+std::vector<unsigned char> compressDXT1(const std::vector<unsigned char>& rgb, int size) {
+    int blocks = (size + 3) / 4;
+    std::vector<unsigned char> out(blocks * blocks * 8);
+    unsigned char pixels[16][3];
+    for (int by = 0; by < blocks; ++by)
+        for (int bx = 0; bx < blocks; ++bx) {
+            for (int i = 0; i < 16; ++i) {
+                int x = std::min(bx * 4 + i % 4, size - 1), y = std::min(by * 4 + i / 4, size - 1);
+                memcpy(pixels[i], &rgb[(y * size + x) * 3], 3);
+            }
+            encodeDXT1Block(pixels, &out[(by * blocks + bx) * 8]);
+        }
+    return out;
+}
+
+CookedTexture cookPixels(std::vector<unsigned char> rgb, int size, bool mips, bool compress) {
+    CookedTexture tex;
+    tex.format = compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8;
+    tex.size = size;
+    for (int level = size;; level = std::max(1, level / 2)) {
+        tex.levels.push_back(compress ? compressDXT1(rgb, level) : rgb);
+        if (!mips || level == 1) break;
+        rgb = downsampleRGB(rgb, level);
     }
+    return tex;
+}
+
+// What cookPixels() produces, used to reject damaged cache files
+int cookedLevelCount(int size, bool mips) {
+    int levels = 1;
+    while (mips && size > 1) { size /= 2; ++levels; }
+    return levels;
 }
 
-GLuint loadTexture(const char* path) {
+size_t cookedLevelBytes(bool compress, int dim) {
+    size_t blocks = size_t((dim + 3) / 4);
+    return compress ? blocks * blocks * 8 : size_t(dim) * dim * 3;
+}
+
+// Load `path` as a size x size RGB texture, from the cache when it is current.
+// Returns no levels if the source image cannot be read.
+CookedTexture loadCookedTexture(const char* path, int size, bool mips, bool compress) {
+    std::string cachePath = std::string(TEXTURE_CACHE_DIR) + "/" + std::filesystem::path(path).filename().string() + ".tex";
+    std::error_code ec;
+    CookedHeader expect;
+    expect.sourceSize = std::filesystem::file_size(path, ec);
+    expect.sourceTime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+    expect.size = size;
+    expect.mips = mips;
+    expect.compress = compress;
+
+    CookedTexture tex;
+    std::ifstream in(cachePath, std::ios::binary);
+    CookedHeader header;
+    if (!cookAssets && in.read((char*)&header, sizeof(header)) && header.magic == expect.magic &&
+        header.version == expect.version && header.sourceSize == expect.sourceSize && header.sourceTime == expect.sourceTime &&
+        header.size == size && header.mips == expect.mips && header.compress == expect.compress &&
+        header.format == (compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8) &&
+        header.levels == cookedLevelCount(size, mips)) {
+        tex.format = header.format;
+        tex.size = size;
+        tex.levels.resize(header.levels);
+        int dim = size;
+        for (auto& level : tex.levels) {
+            uint32_t bytes = 0;
+            in.read((char*)&bytes, sizeof(bytes));
+            if (!in || bytes != cookedLevelBytes(compress, dim)) { in.setstate(std::ios::failbit); break; }
+            level.resize(bytes);
+            in.read((char*)level.data(), bytes);
+            dim = std::max(1, dim / 2);
+        }
+        if (in) return tex;
+        tex.levels.clear(); // truncated or damaged, cook again
+    }
+
     int w, h, ch;
-    unsigned char* data = stbi_load(path, &w, &h, &ch, 0);
-    if (!data) { std::cerr << "Failed to load texture: " << path << std::endl; return 0; }
-    GLuint tex;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, ch == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    unsigned char* data = stbi_load(path, &w, &h, &ch, 3);
+    if (!data) { std::cerr << "Failed to load texture: " << path << std::endl; return tex; }
+    tex = cookPixels(resampleRGB(data, w, h, size), size, mips, compress);
     stbi_image_free(data);
+
+    std::filesystem::create_directories(TEXTURE_CACHE_DIR, ec);
+    std::ofstream out(cachePath, std::ios::binary);
+    expect.format = tex.format;
+    expect.levels = (int32_t)tex.levels.size();
+    out.write((const char*)&expect, sizeof(expect));
+    for (const auto& level : tex.levels) {
+        uint32_t bytes = (uint32_t)level.size();
+        out.write((const char*)&bytes, sizeof(bytes));
+        out.write((const char*)level.data(), bytes);
+    }
+    if (!out) std::cerr << "Failed to write texture cache: " << cachePath << std::endl;
     return tex;
 }
 
-void drawObject(GLuint vao, GLuint shader, int indicesCount, glm::mat4 mvp, glm::vec3 color, GLuint tex = 0) {
-    glUseProgram(shader);
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uMVP"), 1, GL_FALSE, &mvp[0][0]);
-    glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, &color[0]);
-    glUniform1i(glGetUniformLocation(shader, "useTex"), tex ? 1 : 0);
-    if (tex) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tex);
-        glUniform1i(glGetUniformLocation(shader, "uTex"), 0);
+// Pack one image per layer into a GL_TEXTURE_2D_ARRAY so every textured draw
+// shares a single binding and only the layer uniform changes
+GLuint loadTextureArray(const char* const* paths, int layers, int size) {
+    const bool compress = hasGLExtension("GL_EXT_texture_compression_s3tc");
+    std::vector<CookedTexture> images(layers);
+    for (int layer = 0; layer < layers; ++layer) {
+        images[layer] = loadCookedTexture(paths[layer], size, true, compress);
+        if (images[layer].levels.empty())
+            images[layer] = cookPixels(std::vector<unsigned char>(size * size * 3, 128), size, true, compress);
     }
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, indicesCount, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    if (tex) glBindTexture(GL_TEXTURE_2D, 0);
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // Every layer of a level goes up in one call
+    std::vector<unsigned char> levelData;
+    const int levels = (int)images[0].levels.size();
+    for (int level = 0, dim = size; level < levels; ++level, dim = std::max(1, dim / 2)) {
+        levelData.clear();
+        for (const auto& image : images)
+            levelData.insert(levelData.end(), image.levels[level].begin(), image.levels[level].end());
+        if (compress)
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, dim, dim, layers, 0,
+                                   (GLsizei)levelData.size(), levelData.data());
+        else
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, dim, dim, layers, 0, GL_RGB, GL_UNSIGNED_BYTE, levelData.data());
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return tex;
 }
-void drawTextShader(GLuint textShader, const char* text, float x, float y, float scale = 1.0f, glm::vec3 color = glm::vec3(1,1,0)) {
-    char buffer[99999];
-    int num_quads = stb_easy_font_print(0, 0, (char*)text, NULL, buffer, sizeof(buffer));
-    
-    std::vector<float> vertices;
-    for (int i = 0; i < num_quads; ++i) {
-        // Get the 4 vertices of this quad
-        float* quad = (float*)(&buffer[i * 16]);
-        
-        // First triangle of quad (0,1,2)
-        vertices.push_back(quad[0]); vertices.push_back(quad[1]); // pos
-        vertices.push_back(color.r); vertices.push_back(color.g); vertices.push_back(color.b);
-        
-        vertices.push_back(quad[2]); vertices.push_back(quad[3]); // pos
-        vertices.push_back(color.r); vertices.push_back(color.g); vertices.push_back(color.b);
-        
-        vertices.push_back(quad[4]); vertices.push_back(quad[5]); // pos
-        vertices.push_back(color.r); vertices.push_back(color.g); vertices.push_back(color.b);
-        
-        // Second triangle of quad (2,3,0)
-        vertices.push_back(quad[4]); vertices.push_back(quad[5]); // pos
-        vertices.push_back(color.r); vertices.push_back(color.g); vertices.push_back(color.b);
-        
-        vertices.push_back(quad[6]); vertices.push_back(quad[7]); // pos
-        vertices.push_back(color.r); vertices.push_back(color.g); vertices.push_back(color.b);
-        
-        vertices.push_back(quad[0]); vertices.push_back(quad[1]); // pos
-        vertices.push_back(color.r); vertices.push_back(color.g); vertices.push_back(color.b);
+
+// The assets only ship one sky image, so it is used for all six faces.
+// Cube faces must be square, so the image is resampled to size x size.
+GLuint loadCubemap(const char* path, int size) {
+    const bool compress = hasGLExtension("GL_EXT_texture_compression_s3tc");
+    CookedTexture image = loadCookedTexture(path, size, false, compress);
+    if (image.levels.empty()) return 0;
+    const std::vector<unsigned char>& data = image.levels[0];
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int face = 0; face < 6; ++face) {
+        if (compress)
+            glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                                   size, size, 0, (GLsizei)data.size(), data.data());
+        else
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, data.data());
     }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return tex;
+}
 
-    GLuint vao, vbo;
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-    
-    // Position attribute (2 floats)
+// --- Potentially visible set ---
+// Casts rays in grid space (cell (x,y) spans x-0.5..x+0.5) from a 4x4 grid of
+// eye points inside every open cell, walking each ray cell by cell until it
+// hits a wall. Everything the rays touch is marked visible. The result is
+// made symmetric between open cells to cover rays that slipped between samples.
+void bakePVS() {
+    const int RAYS = 512;
+    const float samples[4] = {-0.45f, -0.15f, 0.15f, 0.45f};
+    for (int c = 0; c < MAZE_CELLS; ++c) {
+        pvsCells[c].reset();
+        pvsBlocks[c].reset();
+    }
+    for (int cy = 0; cy < MAZE_H; ++cy) {
+        for (int cx = 0; cx < MAZE_W; ++cx) {
+            if (maze[cy][cx] != 0) continue;
+            auto& visible = pvsCells[cy * MAZE_W + cx];
+            for (float sy : samples) for (float sx : samples) {
+                // Shift by 0.5 so that floor() gives the cell index
+                float ox = cx + sx + 0.5f, oy = cy + sy + 0.5f;
+                for (int r = 0; r < RAYS; ++r) {
+                    float angle = r * (6.2831853f / RAYS);
+                    float dx = std::cos(angle), dy = std::sin(angle);
+                    int x = cx, y = cy;
+                    int stepX = dx > 0 ? 1 : -1, stepY = dy > 0 ? 1 : -1;
+                    float tDeltaX = std::abs(1.0f / dx), tDeltaY = std::abs(1.0f / dy);
+                    float tMaxX = (dx > 0 ? (x + 1 - ox) : (ox - x)) * tDeltaX;
+                    float tMaxY = (dy > 0 ? (y + 1 - oy) : (oy - y)) * tDeltaY;
+                    while (x >= 0 && x < MAZE_W && y >= 0 && y < MAZE_H) {
+                        visible.set(y * MAZE_W + x);
+                        if (maze[y][x] == 1) break;
+                        if (tMaxX < tMaxY) { x += stepX; tMaxX += tDeltaX; }
+                        else               { y += stepY; tMaxY += tDeltaY; }
+                    }
+                }
+            }
+        }
+    }
+    size_t visibleTotal = 0, openCells = 0;
+    for (int a = 0; a < MAZE_CELLS; ++a) {
+        if (maze[a / MAZE_W][a % MAZE_W] != 0) continue;
+        for (int b = a + 1; b < MAZE_CELLS; ++b) {
+            if (maze[b / MAZE_W][b % MAZE_W] != 0) continue;
+            if (pvsCells[a][b] || pvsCells[b][a]) {
+                pvsCells[a].set(b);
+                pvsCells[b].set(a);
+            }
+        }
+        for (int c = 0; c < MAZE_CELLS; ++c) {
+            int x = c % MAZE_W, y = c / MAZE_W;
+            if (pvsCells[a][c] && maze[y][x] == 1)
+                pvsBlocks[a].set((y / MAZE_BLOCK) * BLOCKS_X + x / MAZE_BLOCK);
+        }
+        visibleTotal += pvsCells[a].count();
+        openCells++;
+    }
+    std::cout << "PVS: " << (openCells ? visibleTotal / openCells : 0) << " of " << MAZE_CELLS
+              << " cells visible per open cell on average" << std::endl;
+}
+
+// Is any cell overlapped by the square (gx, gz) +/- halfExtent (grid units) in the PVS?
+bool pvsVisible(int fromCell, float gx, float gz, float halfExtent) {
+    int x0 = std::max(0, int(std::round(gx - halfExtent))), x1 = std::min(MAZE_W - 1, int(std::round(gx + halfExtent)));
+    int z0 = std::max(0, int(std::round(gz - halfExtent))), z1 = std::min(MAZE_H - 1, int(std::round(gz + halfExtent)));
+    for (int z = z0; z <= z1; ++z)
+        for (int x = x0; x <= x1; ++x)
+            if (pvsCells[fromCell][z * MAZE_W + x]) return true;
+    return false;
+}
+
+// --- Maze distance from the player ---
+// BFS over open cells from the player's cell; wall cells take one more than
+// their nearest open neighbour. Wall blocks are drawn in increasing distance,
+// which is front to back through the maze regardless of the view direction.
+const int UNREACHED = 1 << 20;
+int cellDistance[MAZE_H][MAZE_W];
+int blockDistance[BLOCKS_Z * BLOCKS_X];
+int distanceOrigin = -1; // cell the distances were computed from
+
+void updateMazeDistances(int originCell) {
+    if (originCell == distanceOrigin) return;
+    distanceOrigin = originCell;
+    for (auto& row : cellDistance)
+        for (int& d : row) d = UNREACHED;
+    static std::vector<int> frontier;
+    frontier.clear();
+    cellDistance[originCell / MAZE_W][originCell % MAZE_W] = 0;
+    frontier.push_back(originCell);
+    const int dx[4] = {1, -1, 0, 0}, dz[4] = {0, 0, 1, -1};
+    for (size_t head = 0; head < frontier.size(); ++head) {
+        int x = frontier[head] % MAZE_W, z = frontier[head] / MAZE_W;
+        int next = cellDistance[z][x] + 1;
+        for (int k = 0; k < 4; ++k) {
+            int nx = x + dx[k], nz = z + dz[k];
+            if (nx < 0 || nx >= MAZE_W || nz < 0 || nz >= MAZE_H || cellDistance[nz][nx] <= next) continue;
+            cellDistance[nz][nx] = next;
+            if (maze[nz][nx] == 0) frontier.push_back(nz * MAZE_W + nx); // walls are reached, not expanded
+        }
+    }
+    for (int& d : blockDistance) d = UNREACHED;
+    for (int z = 0; z < MAZE_H; ++z)
+        for (int x = 0; x < MAZE_W; ++x) {
+            int& block = blockDistance[(z / MAZE_BLOCK) * BLOCKS_X + x / MAZE_BLOCK];
+            block = std::min(block, cellDistance[z][x]);
+        }
+}
+
+// --- Frustum culling ---
+struct Frustum {
+    glm::vec4 planes[6]; // inside when dot(plane.xyz, p) + plane.w >= 0
+};
+
+// Gribb/Hartmann: the planes are sums/differences of the rows of projection * view
+Frustum extractFrustum(const glm::mat4& m) {
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; ++i)
+        row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    Frustum f;
+    f.planes[0] = row[3] + row[0]; // left
+    f.planes[1] = row[3] - row[0]; // right
+    f.planes[2] = row[3] + row[1]; // bottom
+    f.planes[3] = row[3] - row[1]; // top
+    f.planes[4] = row[3] + row[2]; // near
+    f.planes[5] = row[3] - row[2]; // far
+    return f;
+}
+
+bool aabbInFrustum(const Frustum& f, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+    for (const auto& p : f.planes) {
+        // Corner furthest along the plane normal; if it is outside, the whole box is
+        glm::vec3 v(p.x >= 0 ? boxMax.x : boxMin.x,
+                    p.y >= 0 ? boxMax.y : boxMin.y,
+                    p.z >= 0 ? boxMax.z : boxMin.z);
+        if (p.x * v.x + p.y * v.y + p.z * v.z + p.w < 0) return false;
+    }
+    return true;
+}
+
+struct CullStats {
+    int wallBlocks = 0, wallBlocksCulled = 0, wallBlocksHidden = 0;
+    int enemies = 0, enemiesCulled = 0, enemiesHidden = 0;
+    int bullets = 0, bulletsCulled = 0;
+} cullStats;
+
+// --- Streaming vertex buffer ---
+// One fixed GL buffer used as a ring for data that changes every frame. Each
+// allocation maps its range unsynchronized and is written directly. Every
+// frame's range is guarded by a fence issued after its last draw, and an
+// allocation only waits when it wraps onto a range the GPU may still be
+// reading. A frame that wraps covers two ranges, so a fence holds both.
+// No GL objects are created in the frame loop.
+struct StreamBuffer {
+    struct Fence { GLsync sync; GLsizeiptr begin, end, wrapBegin, wrapEnd; };
+    GLuint buffer = 0;
+    GLsizeiptr size = 0;
+    GLsizeiptr head = 0;        // next free byte
+    GLsizeiptr regionStart = 0; // first byte not yet covered by a fence
+    GLsizeiptr wrapBegin = 0, wrapEnd = 0; // this frame's range before it wrapped
+    std::deque<Fence> fences;   // oldest first
+} streamVertices;
+
+void createStreamBuffer(StreamBuffer& sb, GLsizeiptr size) {
+    glGenBuffers(1, &sb.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, sb.buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    sb.size = size;
+}
+
+// Map `bytes` at an offset that is a multiple of `alignment` (use the vertex
+// stride so draws can address the data with `first`/attribute offsets).
+// The range stays mapped until streamUnmap(). Returns nullptr if it does not
+// fit beside the rest of this frame's data.
+void* streamAlloc(StreamBuffer& sb, GLsizeiptr bytes, GLsizeiptr alignment, GLintptr& offset) {
+    if (bytes <= 0 || bytes > sb.size) return nullptr;
+    GLsizeiptr start = (sb.head + alignment - 1) / alignment * alignment;
+    if (start + bytes > sb.size) {
+        // Draws reading the pre-wrap part may not be issued yet, so it is
+        // fenced with the rest of the frame in streamEndFrame(), not here
+        if (sb.wrapEnd > sb.wrapBegin) return nullptr; // already wrapped this frame
+        sb.wrapBegin = sb.regionStart;
+        sb.wrapEnd = sb.head;
+        sb.head = sb.regionStart = start = 0;
+    }
+    GLsizeiptr end = start + bytes;
+    if (sb.wrapBegin < end && start < sb.wrapEnd) return nullptr; // would overwrite this frame's data
+    auto overlaps = [&](const StreamBuffer::Fence& f) {
+        return (f.begin < end && start < f.end) || (f.wrapBegin < end && start < f.wrapEnd);
+    };
+    while (std::any_of(sb.fences.begin(), sb.fences.end(), overlaps)) {
+        GLsync sync = sb.fences.front().sync;
+        while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(sync);
+        sb.fences.pop_front();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, sb.buffer);
+    void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, start, bytes,
+                                 GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    sb.head = end;
+    offset = start;
+    return ptr;
+}
+
+void streamUnmap(StreamBuffer& sb) {
+    glBindBuffer(GL_ARRAY_BUFFER, sb.buffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Call once per frame after the last draw that reads this frame's data
+void streamEndFrame(StreamBuffer& sb) {
+    if (sb.head > sb.regionStart || sb.wrapEnd > sb.wrapBegin)
+        sb.fences.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+                              sb.regionStart, sb.head, sb.wrapBegin, sb.wrapEnd });
+    sb.regionStart = sb.head;
+    sb.wrapBegin = sb.wrapEnd = 0;
+}
+
+void destroyStreamBuffer(StreamBuffer& sb) {
+    for (auto& f : sb.fences) glDeleteSync(f.sync);
+    sb.fences.clear();
+    glDeleteBuffers(1, &sb.buffer);
+}
+
+// --- Enemy instances ---
+// Enemy state lives on the GPU in a texture buffer and is only rewritten when
+// an enemy spawns, bounces or is hit; between changes the vertex shader
+// extrapolates it from simTime. Each frame only the indices of visible
+// enemies are streamed.
+struct EnemyInstance {
+    glm::vec3 origin;   // world position at moveStart
+    float moveStart;
+    glm::vec3 velocity; // world units per second
+    float smashStart;   // -1 while not smashing
+};
+
+struct EnemyInstances {
+    GLuint buffer = 0, texture = 0;
+    size_t capacity = 0;
+    std::vector<EnemyInstance> data;
+    size_t dirtyBegin = 0, dirtyEnd = 0; // range to upload on the next sync
+} enemyInstances;
+
+void markEnemyChanged(size_t index) {
+    EnemyInstances& ei = enemyInstances;
+    ei.data.resize(enemies.size());
+    const bool smashing = enemies.state[index] == ENEMY_SMASHING;
+    EnemyInstance& inst = ei.data[index];
+    inst.origin = gridToWorld(enemies.x[index], ENEMY_Y, enemies.z[index]);
+    inst.moveStart = simTime;
+    inst.velocity = smashing ? glm::vec3(0.0f) : glm::vec3(enemies.vx[index], 0.0f, enemies.vz[index]) * CELL_SIZE;
+    inst.smashStart = smashing ? enemies.smashStart[index] : -1.0f;
+    if (ei.dirtyBegin == ei.dirtyEnd) {
+        ei.dirtyBegin = index;
+        ei.dirtyEnd = index + 1;
+    } else {
+        ei.dirtyBegin = std::min(ei.dirtyBegin, index);
+        ei.dirtyEnd = std::max(ei.dirtyEnd, index + 1);
+    }
+}
+
+void createEnemyInstances(EnemyInstances& ei) {
+    glGenBuffers(1, &ei.buffer);
+    glGenTextures(1, &ei.texture);
+}
+
+// Upload what changed since the last sync; reallocates when enemies outgrow it
+void syncEnemyInstances(EnemyInstances& ei) {
+    glBindBuffer(GL_TEXTURE_BUFFER, ei.buffer);
+    if (ei.data.size() > ei.capacity) {
+        ei.capacity = ei.data.size();
+        glBufferData(GL_TEXTURE_BUFFER, ei.capacity * sizeof(EnemyInstance), ei.data.data(), GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, ei.texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, ei.buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    } else if (ei.dirtyBegin < ei.dirtyEnd) {
+        glBufferSubData(GL_TEXTURE_BUFFER, ei.dirtyBegin * sizeof(EnemyInstance),
+                        (ei.dirtyEnd - ei.dirtyBegin) * sizeof(EnemyInstance), &ei.data[ei.dirtyBegin]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    ei.dirtyBegin = ei.dirtyEnd = 0;
+}
+
+void destroyEnemyInstances(EnemyInstances& ei) {
+    glDeleteTextures(1, &ei.texture);
+    glDeleteBuffers(1, &ei.buffer);
+    ei = EnemyInstances();
+}
+
+// Occlusion queries per maze cell, two per cell alternating by frame: this
+// frame's query is issued while the draw is conditioned on last frame's, so
+// the GPU never waits for a result and the CPU never reads one back. Each
+// query draws one box around every enemy in the cell, and the enemies in the
+// cell stay a single instanced draw.
+struct CellOcclusion {
+    GLuint queries[MAZE_CELLS * 2] = {};       // [cell * 2 + frame % 2]
+    uint64_t issuedFrame[MAZE_CELLS * 2] = {}; // frame each query was last issued in, 0 = never
+    uint64_t frame = 0;
+} cellOcclusion;
+
+// Visible enemies of one cell, a contiguous range of the streamed indices
+struct EnemyRun {
+    int cell;
+    GLuint first, count;
+};
+
+void createCellOcclusion(CellOcclusion& occ) {
+    glGenQueries(MAZE_CELLS * 2, occ.queries);
+}
+
+void destroyCellOcclusion(CellOcclusion& occ) {
+    glDeleteQueries(MAZE_CELLS * 2, occ.queries);
+    occ = CellOcclusion();
+}
+
+// Projection and view come from the Frame UBO; only the model matrix is per draw.
+// Immediate draw, for HUD geometry outside the render queue
+void drawObject(const Mesh& mesh, const ShaderProgram& shader, const glm::mat4& model, glm::vec3 color,
+                int layer = LAYER_NONE, GLenum mode = GL_TRIANGLES) {
+    glUseProgram(shader.id);
+    glUniformMatrix4fv(shader.loc[U_MODEL], 1, GL_FALSE, &model[0][0]);
+    glUniform3fv(shader.loc[U_COLOR], 1, &color[0]);
+    glUniform1i(shader.loc[U_LAYER], layer);
+    glBindVertexArray(mesh.vao);
+    drawMesh(mesh, mode);
+    glBindVertexArray(0);
+}
+
+// --- GPU profiling ---
+// Named scopes around each render pass, measured with GL_TIME_ELAPSED queries.
+// Query objects are triple-buffered per pass: results are read back three
+// frames later, when they are normally available, so reading never stalls.
+// These are timing labels only; queued scene draws are ordered by passDrawOrder().
+enum GpuPass { PASS_PREPASS, PASS_WALLS, PASS_BULLETS, PASS_FLOOR, PASS_SKY, PASS_ENEMIES, PASS_UPSCALE, PASS_HUD, PASS_COUNT };
+const char* gpuPassNames[PASS_COUNT] = { "prepass", "walls", "bullets", "floor", "sky", "enemies", "upscale", "hud" };
+const int GPU_QUERY_FRAMES = 3;
+
+struct GpuProfiler {
+    GLuint queries[GPU_QUERY_FRAMES][PASS_COUNT] = {};
+    bool issued[GPU_QUERY_FRAMES][PASS_COUNT] = {};
+    uint64_t frame = 0;      // frames begun so far
+    int activePass = -1;     // TIME_ELAPSED queries cannot nest
+    double passMs[PASS_COUNT] = {}; // latest resolved timings
+    std::ofstream log;       // optional CSV, one row per resolved frame
+} gpuProfiler;
+
+void createGpuProfiler(GpuProfiler& prof, const std::string& logPath) {
+    glGenQueries(GPU_QUERY_FRAMES * PASS_COUNT, &prof.queries[0][0]);
+    if (!logPath.empty()) {
+        prof.log.open(logPath);
+        if (!prof.log) std::cerr << "Failed to open GPU log: " << logPath << std::endl;
+        prof.log << "frame";
+        for (const char* name : gpuPassNames) prof.log << "," << name;
+        prof.log << "\n";
+    }
+}
+
+void destroyGpuProfiler(GpuProfiler& prof) {
+    glDeleteQueries(GPU_QUERY_FRAMES * PASS_COUNT, &prof.queries[0][0]);
+}
+
+// Collect the slot this frame is about to reuse, written GPU_QUERY_FRAMES ago
+void gpuBeginFrame(GpuProfiler& prof) {
+    int slot = int(prof.frame % GPU_QUERY_FRAMES);
+    bool resolved = false;
+    for (int pass = 0; pass < PASS_COUNT; ++pass) {
+        if (!prof.issued[slot][pass]) { prof.passMs[pass] = 0.0; continue; }
+        GLint available = 0;
+        glGetQueryObjectiv(prof.queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue; // keep the previous value rather than wait
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(prof.queries[slot][pass], GL_QUERY_RESULT, &ns);
+        prof.passMs[pass] = ns / 1.0e6;
+        prof.issued[slot][pass] = false;
+        resolved = true;
+    }
+    if (resolved && prof.log.is_open()) {
+        prof.log << prof.frame - GPU_QUERY_FRAMES;
+        for (double ms : prof.passMs) prof.log << "," << ms;
+        prof.log << "\n";
+    }
+}
+
+void gpuBeginPass(GpuProfiler& prof, GpuPass pass) {
+    if (prof.activePass >= 0) glEndQuery(GL_TIME_ELAPSED);
+    int slot = int(prof.frame % GPU_QUERY_FRAMES);
+    glBeginQuery(GL_TIME_ELAPSED, prof.queries[slot][pass]);
+    prof.issued[slot][pass] = true;
+    prof.activePass = pass;
+}
+
+void gpuEndPass(GpuProfiler& prof) {
+    if (prof.activePass < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    prof.activePass = -1;
+}
+
+void gpuEndFrame(GpuProfiler& prof) {
+    gpuEndPass(prof);
+    prof.frame++;
+}
+
+// --- Render queue ---
+// Scene draws are collected per frame and sorted by a 64-bit state key:
+//   [63..60] draw order  [59..44] program  [43..28] VAO  [27..20] texture layer + 1  [19..0] depth
+// so each program, VAO and layer is bound once per run. The draw order comes
+// first so each pass is contiguous and can be timed on its own. Consecutive draws with
+// the same state and uniforms are merged into one glMultiDrawElements call.
+// `depth` orders draws with equal state front to back (smaller is nearer).
+struct DrawCmd {
+    uint64_t key = 0;
+    GpuPass pass = PASS_FLOOR;
+    const ShaderProgram* program = nullptr;
+    GLuint vao = 0;
+    int layer = LAYER_NONE;
+    glm::mat4 model = glm::mat4(1.0f);
+    glm::vec3 color = glm::vec3(1.0f);
+    GLsizei count = 0;      // indices
+    GLsizei firstIndex = 0; // into the VAO's element buffer
+    GLint baseVertex = 0;
+    GLsizei instanceCount = 0; // > 0 for instanced draws, never merged
+};
+
+struct RenderQueue {
+    std::vector<DrawCmd> cmds;
+    int drawCalls = 0, stateChanges = 0; // last flush, for the debug overlay
+} renderQueue;
+
+// Where each queued pass goes in the frame. Walls occlude most of the floor,
+// so they go first to let early-Z reject hidden floor pixels.
+uint32_t passDrawOrder(GpuPass pass) {
+    switch (pass) {
+    case PASS_WALLS:   return 0;
+    case PASS_BULLETS: return 1;
+    case PASS_FLOOR:   return 2;
+    default:           return 15; // not a queued pass
+    }
+}
+
+uint64_t makeSortKey(uint32_t order, GLuint program, GLuint vao, int layer, uint32_t depth) {
+    return (uint64_t(order & 0xF) << 60) | (uint64_t(program & 0xFFFF) << 44) |
+           (uint64_t(vao & 0xFFFF) << 28) | (uint64_t((layer + 1) & 0xFF) << 20) | uint64_t(std::min(depth, 0xFFFFFu));
+}
+
+void queueDraw(RenderQueue& queue, GpuPass pass, const ShaderProgram& program, GLuint vao, GLsizei count, GLsizei firstIndex,
+               const glm::mat4& model, glm::vec3 color, int layer = LAYER_NONE, GLsizei instanceCount = 0,
+               uint32_t depth = 0) {
+    DrawCmd cmd;
+    cmd.key = makeSortKey(passDrawOrder(pass), program.id, vao, layer, depth);
+    cmd.pass = pass;
+    cmd.program = &program;
+    cmd.vao = vao;
+    cmd.layer = layer;
+    cmd.model = model;
+    cmd.color = color;
+    cmd.count = count;
+    cmd.firstIndex = firstIndex;
+    cmd.instanceCount = instanceCount;
+    queue.cmds.push_back(cmd);
+}
+
+void queueDraw(RenderQueue& queue, GpuPass pass, const ShaderProgram& program, const Mesh& mesh,
+               const glm::mat4& model, glm::vec3 color, int layer = LAYER_NONE, GLsizei instanceCount = 0,
+               uint32_t depth = 0) {
+    queueDraw(queue, pass, program, mesh.vao, mesh.indexCount, mesh.firstIndex, model, color, layer, instanceCount, depth);
+    queue.cmds.back().baseVertex = mesh.baseVertex;
+}
+
+// Lay down wall depth only; the colour pass then shades each covered pixel once
+void drawDepthPrepass(const RenderQueue& queue, const ShaderProgram& depthProgram) {
+    gpuBeginPass(gpuProfiler, PASS_PREPASS);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glUseProgram(depthProgram.id);
+    GLuint boundVAO = 0;
+    const glm::mat4* lastModel = nullptr;
+    for (const DrawCmd& cmd : queue.cmds) {
+        if (cmd.pass != PASS_WALLS) continue;
+        if (cmd.vao != boundVAO) { glBindVertexArray(cmd.vao); boundVAO = cmd.vao; }
+        if (!lastModel || *lastModel != cmd.model) {
+            glUniformMatrix4fv(depthProgram.loc[U_MODEL], 1, GL_FALSE, &cmd.model[0][0]);
+            lastModel = &cmd.model;
+        }
+        glDrawElementsBaseVertex(GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT,
+                                 (const void*)(cmd.firstIndex * sizeof(unsigned int)), cmd.baseVertex);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glBindVertexArray(0);
+    gpuEndPass(gpuProfiler);
+}
+
+void flushRenderQueue(RenderQueue& queue, GLuint textureArray, const ShaderProgram* depthPrepass = nullptr) {
+    std::stable_sort(queue.cmds.begin(), queue.cmds.end(),
+                     [](const DrawCmd& a, const DrawCmd& b) { return a.key < b.key; });
+    if (depthPrepass) {
+        drawDepthPrepass(queue, *depthPrepass);
+        glDepthFunc(GL_LEQUAL); // prepassed walls pass again at equal depth
+    }
+    static std::vector<GLsizei> counts;
+    static std::vector<const void*> offsets;
+    static std::vector<GLint> baseVertices;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+    queue.drawCalls = queue.stateChanges = 0;
+    const ShaderProgram* boundProgram = nullptr;
+    GLuint boundVAO = 0;
+    int boundLayer = LAYER_COUNT; // forces the first upload
+    const DrawCmd* lastUniforms = nullptr;
+    int currentPass = -1;
+    size_t i = 0;
+    while (i < queue.cmds.size()) {
+        const DrawCmd& cmd = queue.cmds[i];
+        if (cmd.pass != currentPass) {
+            gpuBeginPass(gpuProfiler, cmd.pass);
+            currentPass = cmd.pass;
+        }
+        if (cmd.program != boundProgram) {
+            glUseProgram(cmd.program->id);
+            boundProgram = cmd.program;
+            boundLayer = LAYER_COUNT;
+            lastUniforms = nullptr;
+            queue.stateChanges++;
+        }
+        if (cmd.vao != boundVAO) {
+            glBindVertexArray(cmd.vao);
+            boundVAO = cmd.vao;
+            queue.stateChanges++;
+        }
+        if (cmd.layer != boundLayer) {
+            glUniform1i(cmd.program->loc[U_LAYER], cmd.layer);
+            boundLayer = cmd.layer;
+        }
+        if (!lastUniforms || lastUniforms->model != cmd.model)
+            glUniformMatrix4fv(cmd.program->loc[U_MODEL], 1, GL_FALSE, &cmd.model[0][0]);
+        if (!lastUniforms || lastUniforms->color != cmd.color)
+            glUniform3fv(cmd.program->loc[U_COLOR], 1, &cmd.color[0]);
+        lastUniforms = &cmd;
+
+        if (cmd.instanceCount > 0) {
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT,
+                                              (const void*)(cmd.firstIndex * sizeof(unsigned int)),
+                                              cmd.instanceCount, cmd.baseVertex);
+            queue.drawCalls++;
+            ++i;
+            continue;
+        }
+
+        // Batch following draws that need no state or uniform change
+        counts.clear();
+        offsets.clear();
+        baseVertices.clear();
+        size_t j = i;
+        GLsizei rangeEnd = -1;
+        const uint64_t stateMask = ~uint64_t(0xFFFFF); // ignore depth when batching
+        while (j < queue.cmds.size() && (queue.cmds[j].key & stateMask) == (cmd.key & stateMask) &&
+               queue.cmds[j].instanceCount == 0 &&
+               queue.cmds[j].model == cmd.model && queue.cmds[j].color == cmd.color) {
+            const DrawCmd& next = queue.cmds[j];
+            if (next.firstIndex == rangeEnd && next.baseVertex == baseVertices.back()) {
+                counts.back() += next.count; // contiguous index ranges
+            } else {
+                counts.push_back(next.count);
+                offsets.push_back((const void*)(next.firstIndex * sizeof(unsigned int)));
+                baseVertices.push_back(next.baseVertex);
+            }
+            rangeEnd = next.firstIndex + next.count;
+            ++j;
+        }
+        if (counts.size() == 1)
+            glDrawElementsBaseVertex(GL_TRIANGLES, counts[0], GL_UNSIGNED_INT, offsets[0], baseVertices[0]);
+        else
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+                                          (GLsizei)counts.size(), baseVertices.data());
+        queue.drawCalls++;
+        i = j;
+    }
+    gpuEndPass(gpuProfiler);
+    glDepthFunc(GL_LESS);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    queue.cmds.clear();
+}
+// --- Text ---
+// Strings are queued during the frame and drawn together by flushText() from
+// one persistent vertex buffer. Glyph quads per string are cached, and when a
+// frame queues exactly the same text as the last one (e.g. "GAME OVER") the
+// buffer is reused without rebuilding or uploading anything.
+struct TextItem {
+    std::string text;
+    float x, y, scale;
+    glm::vec3 color;
+    bool operator==(const TextItem& o) const {
+        return text == o.text && x == o.x && y == o.y && scale == o.scale && color == o.color;
+    }
+};
+
+struct TextBatch {
+    GLuint vao = 0, vbo = 0;
+    GLsizeiptr capacity = 0;  // bytes allocated in vbo
+    GLsizei vertexCount = 0;  // vertices uploaded for lastItems
+    std::vector<TextItem> items, lastItems;
+    std::unordered_map<std::string, std::vector<float>> glyphCache; // text -> x,y per vertex (stb pixels)
+} textBatch;
+
+void createTextBatch(TextBatch& batch) {
+    glGenVertexArrays(1, &batch.vao);
+    glGenBuffers(1, &batch.vbo);
+    glBindVertexArray(batch.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
-    
-    // Color attribute (3 floats)
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(1);
-    
-    glUseProgram(textShader);
-    glUniform2f(glGetUniformLocation(textShader, "uOffset"), x, y);
-    glUniform1f(glGetUniformLocation(textShader, "uScale"), scale);
-    
-    // Draw as triangles, 6 vertices per quad
-    glDrawArrays(GL_TRIANGLES, 0, num_quads * 6);
-    
     glBindVertexArray(0);
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void destroyTextBatch(TextBatch& batch) {
+    glDeleteVertexArrays(1, &batch.vao);
+    glDeleteBuffers(1, &batch.vbo);
+}
+
+// Two triangles per stb_easy_font quad, in stb's pixel space
+const std::vector<float>& glyphQuads(TextBatch& batch, const std::string& text) {
+    auto it = batch.glyphCache.find(text);
+    if (it != batch.glyphCache.end()) return it->second;
+    if (batch.glyphCache.size() > 256) batch.glyphCache.clear(); // changing debug strings
+    static std::vector<char> scratch(64 * 1024);
+    int numQuads = stb_easy_font_print(0, 0, (char*)text.c_str(), NULL, scratch.data(), (int)scratch.size());
+    std::vector<float>& xy = batch.glyphCache[text];
+    xy.reserve(numQuads * 12);
+    for (int i = 0; i < numQuads; ++i) {
+        const float* quad = (const float*)&scratch[i * 64]; // 4 vertices of x,y,z,color
+        const int order[6] = {0, 1, 2, 2, 3, 0};
+        for (int k : order) {
+            xy.push_back(quad[k * 4 + 0]);
+            xy.push_back(quad[k * 4 + 1]);
+        }
+    }
+    return xy;
+}
+
+void queueText(const char* text, float x, float y, float scale = 1.0f, glm::vec3 color = glm::vec3(1,1,0)) {
+    textBatch.items.push_back({ text, x, y, scale, color });
+}
+
+void flushText(const ShaderProgram& textShader) {
+    TextBatch& batch = textBatch;
+    if (batch.items != batch.lastItems) {
+        static std::vector<float> vertices;
+        vertices.clear();
+        for (const TextItem& item : batch.items) {
+            const std::vector<float>& xy = glyphQuads(batch, item.text);
+            for (size_t i = 0; i + 1 < xy.size(); i += 2) {
+                // stb_easy_font's y grows downward
+                vertices.insert(vertices.end(), { xy[i] * item.scale + item.x, -xy[i + 1] * item.scale + item.y,
+                                                  item.color.r, item.color.g, item.color.b });
+            }
+        }
+        GLsizeiptr bytes = vertices.size() * sizeof(float);
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+        if (bytes > batch.capacity) {
+            batch.capacity = std::max<GLsizeiptr>(bytes, batch.capacity * 2);
+            glBufferData(GL_ARRAY_BUFFER, batch.capacity, nullptr, GL_DYNAMIC_DRAW);
+        }
+        if (bytes > 0) glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, vertices.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        batch.vertexCount = GLsizei(vertices.size() / 5);
+        batch.lastItems.swap(batch.items);
+    }
+    batch.items.clear();
+    if (batch.vertexCount == 0) return;
+
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(textShader.id);
+    glBindVertexArray(batch.vao);
+    glDrawArrays(GL_TRIANGLES, 0, batch.vertexCount);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
 }
 
 // // glDrawArrays(GL_TRIANGLES, 0, num_quads * 6);
@@ -608,52 +2133,382 @@ void drawTextShader(GLuint textShader, const char* text, float x, float y, float
 //     glDeleteVertexArrays(1, &vao);
 // }
 
+// --- Headless benchmark mode ---
+// `--headless` renders without a window into an FBO through an EGL
+// surfaceless context (e.g. Mesa llvmpipe on machines with no GPU or display),
+// runs a fixed number of frames with a fixed simulation step and a scripted
+// camera sweep, then prints frame time statistics and exits.
+struct HeadlessOptions {
+    bool enabled = false;
+    int width = 1280, height = 720;
+    int frames = 600;
+} headless;
+
+#ifdef HAVE_EGL
+struct HeadlessContext {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+} headlessContext;
+
+bool createHeadlessContext(HeadlessContext& hc) {
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        hc.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (hc.display == EGL_NO_DISPLAY)
+        hc.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (hc.display == EGL_NO_DISPLAY || !eglInitialize(hc.display, nullptr, nullptr)) {
+        std::cerr << "Failed to initialize EGL display\n";
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    // Surfaceless displays only expose pbuffer configs; the default window bit matches none
+    const EGLint configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(hc.display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        std::cerr << "No EGL config for desktop OpenGL\n";
+        return false;
+    }
+    // Same 3.3 core context the windowed path asks GLFW for
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    hc.context = eglCreateContext(hc.display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (hc.context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(hc.display, EGL_NO_SURFACE, EGL_NO_SURFACE, hc.context)) {
+        std::cerr << "Failed to create surfaceless EGL context\n";
+        return false;
+    }
+    return true;
+}
+
+void destroyHeadlessContext(HeadlessContext& hc) {
+    if (hc.display == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(hc.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (hc.context != EGL_NO_CONTEXT) eglDestroyContext(hc.display, hc.context);
+    eglTerminate(hc.display);
+}
+#endif
+
+// Colour + depth renderbuffers standing in for the window's backbuffer
+struct RenderTarget {
+    GLuint fbo = 0, color = 0, depth = 0;
+    int width = 0, height = 0;
+};
+
+bool createRenderTarget(RenderTarget& rt, int width, int height) {
+    rt.width = width;
+    rt.height = height;
+    glGenFramebuffers(1, &rt.fbo);
+    glGenRenderbuffers(1, &rt.color);
+    glGenRenderbuffers(1, &rt.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, rt.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, rt.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rt.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rt.depth);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (!complete) std::cerr << "Render target " << width << "x" << height << " is incomplete\n";
+    return complete;
+}
+
+void destroyRenderTarget(RenderTarget& rt) {
+    glDeleteFramebuffers(1, &rt.fbo);
+    glDeleteRenderbuffers(1, &rt.color);
+    glDeleteRenderbuffers(1, &rt.depth);
+    rt = RenderTarget();
+}
+
+// --- Dynamic resolution ---
+// The 3D scene renders into the lower-left `scale` fraction of a native-size
+// target, which is then stretched onto the output framebuffer. Keeping the
+// target at full size means changing the scale never reallocates anything.
+struct DynamicResolution {
+    RenderTarget target;
+    float scale = 1.0f;
+    float minScale = 0.5f;
+    double targetMs = 1000.0 / 60.0; // GPU budget per frame
+} dynRes;
+
+// Steer the scale from the last resolved GPU frame time. Fill cost follows
+// pixel count, i.e. scale squared; back off fast when over budget and recover
+// slowly so the scale does not oscillate.
+void updateDynamicResolution(DynamicResolution& dr, const GpuProfiler& prof) {
+    double gpuMs = 0.0;
+    for (double ms : prof.passMs) gpuMs += ms;
+    if (gpuMs <= 0.0) return; // nothing resolved yet
+    float ideal = dr.scale * (float)std::sqrt(dr.targetMs / gpuMs);
+    float rate = ideal < dr.scale ? 0.3f : 0.05f;
+    dr.scale = std::clamp(dr.scale + (ideal - dr.scale) * rate, dr.minScale, 1.0f);
+}
+
+// Bind the scene target sized for the output and return the scene viewport size
+void beginScaledScene(DynamicResolution& dr, int width, int height, int& sceneWidth, int& sceneHeight) {
+    if (dr.target.width != width || dr.target.height != height) {
+        destroyRenderTarget(dr.target);
+        createRenderTarget(dr.target, width, height);
+    }
+    sceneWidth = std::max(1, int(width * dr.scale));
+    sceneHeight = std::max(1, int(height * dr.scale));
+    glBindFramebuffer(GL_FRAMEBUFFER, dr.target.fbo);
+}
+
+// Stretch the scene onto the output; the HUD then draws on top at native size
+void upscaleScene(const DynamicResolution& dr, GLuint outputFBO, int sceneWidth, int sceneHeight, int width, int height) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dr.target.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, outputFBO);
+    glBlitFramebuffer(0, 0, sceneWidth, sceneHeight, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
+    glViewport(0, 0, width, height);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void printFrameStats(std::vector<double> frameMs) {
+    if (frameMs.empty()) return;
+    std::sort(frameMs.begin(), frameMs.end());
+    double total = 0.0;
+    for (double ms : frameMs) total += ms;
+    auto percentile = [&](double p) { return frameMs[std::min(frameMs.size() - 1, size_t(p * frameMs.size()))]; };
+    double avg = total / frameMs.size();
+    printf("Frames: %zu at %dx%d\n", frameMs.size(), headless.width, headless.height);
+    printf("Frame ms: avg %.3f  min %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n",
+           avg, frameMs.front(), percentile(0.50), percentile(0.95), percentile(0.99), frameMs.back());
+    printf("FPS: %.1f\n", 1000.0 / avg);
+}
+
+std::string gpuLogPath; // per-pass GPU timings as CSV, empty to disable
+
+bool parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless") headless.enabled = true;
+        else if (arg == "--width" && hasValue) headless.width = std::max(1, atoi(argv[++i]));
+        else if (arg == "--height" && hasValue) headless.height = std::max(1, atoi(argv[++i]));
+        else if (arg == "--frames" && hasValue) headless.frames = std::max(1, atoi(argv[++i]));
+        else if (arg == "--gpu-log" && hasValue) gpuLogPath = argv[++i];
+        else if (arg == "--depth-prepass") params.depthPrepass = true;
+        else if (arg == "--cook-assets") cookAssets = true;
+        else if (arg == "--occlusion") params.occlusionQueries = true;
+        else if (arg == "--enemies" && hasValue) enemySpawnCount = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--tick-rate" && hasValue) simRate = std::max(1.0f, (float)std::atof(argv[++i]));
+        else if (arg == "--dynamic-res" && hasValue && std::atof(argv[i + 1]) > 0.0) { // budget must be positive
+            params.dynamicResolution = true;
+            dynRes.targetMs = std::atof(argv[++i]);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--headless] [--width W] [--height H] [--frames N] [--gpu-log FILE.csv] [--depth-prepass] [--dynamic-res BUDGET_MS] [--cook-assets] [--occlusion] [--tick-rate HZ] [--enemies N]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+double nowSeconds() {
+    using clock = std::chrono::steady_clock;
+    static const clock::time_point start = clock::now();
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
 // Global state
 bool gameOver = false;
 bool prevMousePressed = false;
 bool anyAlive = false;
 
+// --- Simulation ---
+// Everything that integrates over time advances in fixed ticks of 1/simRate
+// seconds, so behaviour and cost do not depend on the frame rate.
+float simAccumulator = 0.0f;        // frame time not yet simulated
+const float MAX_FRAME_TIME = 0.25f; // longer hitches are dropped, not caught up
+
+// Deterministic jitter in [0, 1) from two integers, replacing rand() so a run
+// replays identically and enemies can be updated in any order
+float hashUnit(uint32_t a, uint32_t b) {
+    uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u;
+    h ^= h >> 15; h *= 0x2C1B3C6Du;
+    h ^= h >> 12; h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return (h >> 8) * (1.0f / 16777216.0f);
+}
 
-int main() {
-    if (!glfwInit()) return -1;
-    // Request OpenGL 3.3 Core profile
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+// Vectorizable part of the enemy tick: no branches or calls, only selects, and
+// restrict-qualified parameters so the compiler knows the arrays are distinct.
+// Moves every alive enemy, kills finished smashes, flags enemies that ran
+// into a wall and returns nonzero if an alive enemy touches the player.
+int moveEnemiesKernel(size_t n, float dt, float now, float playerX, float playerZ,
+                      float* __restrict x, float* __restrict z,
+                      const float* __restrict vx, const float* __restrict vz,
+                      const float* __restrict smashStart, uint8_t* __restrict state,
+                      uint8_t* __restrict bounced, const int* __restrict cells) {
+    const float contact2 = 0.4f * 0.4f;
+    int touching = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const int moving = state[i] == ENEMY_ALIVE;
+        const float nx = x[i] + vx[i] * dt, nz = z[i] + vz[i] * dt;
+        // The maze border is solid, so clamping stands in for a bounds check
+        const int cx = std::min(std::max(int(nx + 0.5f), 0), MAZE_W - 1);
+        const int cz = std::min(std::max(int(nz + 0.5f), 0), MAZE_H - 1);
+        const int open = cells[cz * MAZE_W + cx] == 0;
+        const int step = moving & open;
+        x[i] = step ? nx : x[i];
+        z[i] = step ? nz : z[i];
+        bounced[i] = uint8_t(moving & (open ^ 1));
+        const float dx = x[i] * CELL_SIZE - 10.5f - playerX, dz = z[i] * CELL_SIZE - 10.5f - playerZ;
+        touching |= moving & (dx * dx + dz * dz < contact2);
+        // Smash animation lasts 0.5s
+        const int expired = (state[i] == ENEMY_SMASHING) & (now - smashStart[i] > 0.5f);
+        state[i] = expired ? uint8_t(ENEMY_DEAD) : state[i];
+    }
+    return touching;
+}
+
+// One tick of enemy movement: the kernel above over the whole SoA, then a
+// scalar pass bouncing the (few) enemies that hit a wall.
+// Returns true if a moving enemy touches the player.
+bool updateEnemies(EnemyArrays& en, float dt, float playerX, float playerZ) {
+    const size_t n = en.size();
+    int touching = moveEnemiesKernel(n, dt, simTime, playerX, playerZ, en.x.data(), en.z.data(),
+                                     en.vx.data(), en.vz.data(), en.smashStart.data(), en.state.data(),
+                                     en.bounced.data(), &maze[0][0]);
+    for (size_t i = 0; i < n; ++i) {
+        if (!en.bounced[i]) continue;
+        // Bounce and randomize direction a bit
+        en.vx[i] = -en.vx[i] + (hashUnit(uint32_t(i) * 2, simTick) - 0.5f) * 0.25f;
+        en.vz[i] = -en.vz[i] + (hashUnit(uint32_t(i) * 2 + 1, simTick) - 0.5f) * 0.25f;
+        markEnemyChanged(i);
+    }
+    return touching != 0;
+}
+
+void stepSimulation(float dt) {
+    prevCamPos = camPos;
+    for (size_t i = 0; i < bullets.count; ++i) bullets.items[i].prevPos = bullets.items[i].pos;
+    simTime += dt;
+    simTick++;
+
+    movePlayer(camPos, moveInput * (5.0f * dt));
+
+    // Update bullets; dead ones are swap-removed, so only advance i on survivors
+    for (size_t bi = 0; bi < bullets.count;) {
+        Bullet& b = bullets.items[bi];
+        b.pos += b.dir * b.speed * dt;
+        // Remove bullet if too far
+        bool dead = glm::length(b.pos - camPos) > 50.0f;
+
+        // Check collision with enemies in the bullet's cell and its neighbours;
+        // the hit radius is well under a cell, so nothing further can be hit
+        const int bx = worldToCell(b.pos.x), bz = worldToCell(b.pos.z);
+        for (int cz = std::max(bz - 1, 0); cz <= std::min(bz + 1, MAZE_H - 1); ++cz)
+        for (int cx = std::max(bx - 1, 0); cx <= std::min(bx + 1, MAZE_W - 1); ++cx) {
+            const int c = cz * MAZE_W + cx;
+            for (int k = enemyGrid.cellStart[c]; k < enemyGrid.cellStart[c + 1]; ++k) {
+                const int i = enemyGrid.indices[k];
+                if (enemies.state[i] != ENEMY_ALIVE) continue;
+                glm::vec3 enemyWorld = gridToWorld(enemies.x[i], ENEMY_Y, enemies.z[i]);
+                float dist = glm::distance(glm::vec3(b.pos.x, 1.0f, b.pos.z), glm::vec3(enemyWorld.x, 1.0f, enemyWorld.z));
+                if (dist < 0.35f) { // Adjust threshold as needed
+                    enemies.state[i] = ENEMY_SMASHING;
+                    enemies.smashStart[i] = simTime;
+                    markEnemyChanged(i);
+                    dead = true;
+                }
+            }
+        }
+        if (dead) removeBullet(bullets, bi);
+        else ++bi;
+    }
+
+    // Gravity and jump
+    const float gravity = -15.0f;
+    float groundY = 1.6f;
+    if (isJumping) {
+        camYVelocity += gravity * dt;
+        camPos.y += camYVelocity * dt;
+        if (camPos.y <= groundY) {
+            camPos.y = groundY;
+            camYVelocity = 0.0f;
+            isJumping = false;
+        }
+    }
+    // Prevent player from going below ground even if not jumping
+    if (camPos.y < groundY) camPos.y = groundY;
+
+    if (updateEnemies(enemies, dt, camPos.x, camPos.z) && !headless.enabled)
+        gameOver = true;
+    binEnemies(enemyGrid, enemies);
+}
+
+
+int main(int argc, char** argv) {
+    if (!parseArgs(argc, argv)) return -1;
+    GLFWwindow* window = nullptr;
+    if (headless.enabled) {
+#ifdef HAVE_EGL
+        if (!createHeadlessContext(headlessContext)) { destroyHeadlessContext(headlessContext); return -1; }
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+            std::cerr << "Failed to initialize GLAD\n";
+            return -1;
+        }
+#else
+        std::cerr << "--headless needs a build with EGL\n";
+        return -1;
+#endif
+    } else {
+        if (!glfwInit()) return -1;
+        // Request OpenGL 3.3 Core profile
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 #if defined(__APPLE__)
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
-    GLFWwindow* window = glfwCreateWindow(1200, 800, "Simple FPS Maze", NULL, NULL);
-    if (!window) { std::cerr << "Failed to create window n"; glfwTerminate(); return -1; }
-    // glfwSetWindowPos(window, 800, 800);
-
-    // Create ImGui window
-    // GLFWwindow* imguiWindow = glfwCreateWindow(400, 600, "Debug Controls", NULL, NULL);
-    // if (!imguiWindow) {
-    //     glfwDestroyWindow(imguiWindow);
-    //     glfwTerminate();
-    //     return -1;
-    // }
+        window = glfwCreateWindow(1200, 800, "Simple FPS Maze", NULL, NULL);
+        if (!window) { std::cerr << "Failed to create window n"; glfwTerminate(); return -1; }
+        // glfwSetWindowPos(window, 800, 800);
+
+        // Create ImGui window
+        // GLFWwindow* imguiWindow = glfwCreateWindow(400, 600, "Debug Controls", NULL, NULL);
+        // if (!imguiWindow) {
+        //     glfwDestroyWindow(imguiWindow);
+        //     glfwTerminate();
+        //     return -1;
+        // }
 
     
-    // glfwSetWindowPos(window, 100, 100);
-    // glfwSetWindowPos(imguiWindow, 1320, 100);
+        // glfwSetWindowPos(window, 100, 100);
+        // glfwSetWindowPos(imguiWindow, 1320, 100);
 
 
-    glfwMakeContextCurrent(window);
+        glfwMakeContextCurrent(window);
    
-    // Initialize GLAD
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cerr << "Failed to initialize GLAD\n";
-        return -1;
+        // Initialize GLAD
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            std::cerr << "Failed to initialize GLAD\n";
+            return -1;
+        }
+
+        // Ensure viewport matches actual framebuffer size (handles HiDPI / scaling)
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        glViewport(0, 0, fbWidth, fbHeight);
+        // Register callback so future window resizes update viewport too
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     }
 
-    // Ensure viewport matches actual framebuffer size (handles HiDPI / scaling)
-    int fbWidth, fbHeight;
-    glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
-    glViewport(0, 0, fbWidth, fbHeight);
-    // Register callback so future window resizes update viewport too
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    // Headless frames go to an offscreen target of the requested size
+    RenderTarget headlessTarget;
+    if (headless.enabled) {
+        if (!createRenderTarget(headlessTarget, headless.width, headless.height)) return -1;
+        glBindFramebuffer(GL_FRAMEBUFFER, headlessTarget.fbo);
+        glViewport(0, 0, headless.width, headless.height);
+        std::cout << "Headless renderer: " << glGetString(GL_RENDERER) << std::endl;
+    }
 
 
     //  IMGUI_CHECKVERSION();
@@ -665,63 +2520,42 @@ int main() {
     glEnable(GL_DEPTH_TEST);
 
     // Compile shaders
-    GLuint shader = createShaderProgram();
-
-    GLuint textShader = createTextShaderProgram();
-
-    // Cube VAO/VBO/EBO
-    GLuint cubeVAO, cubeVBO, cubeEBO;
-    glGenVertexArrays(1, &cubeVAO);
-    glGenBuffers(1, &cubeVBO);
-    glGenBuffers(1, &cubeEBO);
-    glBindVertexArray(cubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0); // position
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float))); // texcoord
-    glEnableVertexAttribArray(1);
-
-    // Floor VAO/VBO/EBO
-    GLuint floorVAO, floorVBO, floorEBO;
-    glGenVertexArrays(1, &floorVAO);
-    glGenBuffers(1, &floorVBO);
-    glGenBuffers(1, &floorEBO);
-    glBindVertexArray(floorVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, floorVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(floorVertices), floorVertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, floorEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(floorIndices), floorIndices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // Gun VAO/VBO/EBO (drawn in NDC)
-    GLuint gunVAO, gunVBO, gunEBO;
-    glGenVertexArrays(1, &gunVAO);
-    glGenBuffers(1, &gunVBO);
-    glGenBuffers(1, &gunEBO);
-    glBindVertexArray(gunVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, gunVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(gunVertices), gunVertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gunEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(gunIndices), gunIndices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    glBindVertexArray(0);
-
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, mouse_callback);
+    ShaderProgram shader = createShaderProgram();
+    ShaderProgram hudShader = createHudShaderProgram();
+    ShaderProgram instancedShader = createInstancedShaderProgram();
+    ShaderProgram depthShader = createDepthShaderProgram();
+    ShaderProgram enemyShader = createEnemyShaderProgram();
+    ShaderProgram skyShader = createSkyShaderProgram();
+
+    ShaderProgram textShader = createTextShaderProgram();
+
+    // Projection and view, uploaded once per frame
+    GLuint frameUBO;
+    glGenBuffers(1, &frameUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UBO_BINDING, frameUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    createGpuProfiler(gpuProfiler, gpuLogPath);
+
+    // Per-frame vertex data (bullet instances, enemy indices) lives in one ring buffer
+    createStreamBuffer(streamVertices, 4 * 1024 * 1024);
+    createEnemyInstances(enemyInstances);
+    createCellOcclusion(cellOcclusion);
+
+    createTextBatch(textBatch);
+
+    if (window) {
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, mouse_callback);
+    }
 
-    GLuint floorTexture = loadTexture("assets/floor.jpg");
-    GLuint wallTexture = loadTexture("assets/wall.jpg"); 
-    GLuint enemyTexture = loadTexture("assets/enemy.jpg"); 
+    const char* layerPaths[LAYER_COUNT] = { "assets/floor.jpg", "assets/wall.jpg", "assets/enemy.jpg" };
+    GLuint sceneTextures = loadTextureArray(layerPaths, LAYER_COUNT, TEXTURE_ARRAY_SIZE);
 
-    GLuint skyTexture = loadTexture("assets/sky.jpg");
+    GLuint skyCubemap = loadCubemap("assets/sky.jpg", SKY_SIZE);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     
     // // --- Maze and enemy setup ---
     generateMaze();
@@ -732,26 +2566,20 @@ int main() {
     }
     buildWalls();
     std::cout << "Walls: " << wallPositions.size() << std::endl;
+    bakeMazeMesh(staticGeometry);
+
+    // Static meshes, the maze included, share one VAO, vertex buffer and index buffer
+    Mesh cubeMesh = registerMesh(staticGeometry, cubeVertices, 24, 5, cubeIndices, 36);
+    Mesh floorMesh = registerMesh(staticGeometry, floorVertices, 4, 5, floorIndices, 6);
+    Mesh gunMesh = registerMesh(staticGeometry, gunVertices, 4, 3, gunIndices, 6); // drawn in NDC
+    Mesh crossMesh = registerMesh(staticGeometry, crosshairVertices, 4, 3, crosshairIndices, 4);
+    uploadGeometry(staticGeometry, { &mazeMesh.mesh, &cubeMesh, &floorMesh, &gunMesh, &crossMesh });
+
+    bakePVS();
     spawnEnemies();
     std::cout << "Enemies: " << enemies.size() << std::endl;
-    camPos = glm::vec3((1-7)*1.5f, 1.6f, (1-7)*1.5f); // Start at maze entrance
-
-    // Crosshair setup (static, only create once)
-    float crosshairVertices[] = {
-        -0.03f,  0.0f, 0.0f,
-         0.03f,  0.0f, 0.0f,
-         0.0f, -0.03f, 0.0f,
-         0.0f,  0.03f, 0.0f
-    };
-    GLuint crossVAO, crossVBO;
-    glGenVertexArrays(1, &crossVAO);
-    glGenBuffers(1, &crossVBO);
-    glBindVertexArray(crossVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, crossVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(crosshairVertices), crosshairVertices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glBindVertexArray(0);
+    camPos = prevCamPos = glm::vec3((1-7)*1.5f, 1.6f, (1-7)*1.5f); // Start at maze entrance
+
 // while (!glfwWindowShouldClose(window)) {
 //     glClearColor(0.2f, 0.3f, 0.4f, 1.0f);
 //     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -759,9 +2587,20 @@ int main() {
 //     glfwPollEvents();
 // }
 
-    while (!glfwWindowShouldClose(window)) { //} && !glfwWindowShouldClose(imguiWindow)) {
-        glfwMakeContextCurrent(window);
-        process_input(window);
+    std::vector<double> frameMs;
+    frameMs.reserve(headless.frames);
+    int frameIndex = 0;
+    while (headless.enabled ? frameIndex < headless.frames : !glfwWindowShouldClose(window)) { //} && !glfwWindowShouldClose(imguiWindow)) {
+        double frameStart = nowSeconds();
+        if (window) {
+            glfwMakeContextCurrent(window);
+            process_input(window);
+        } else {
+            // Scripted camera: one full turn over the run, looking slightly down
+            yaw = -90.0f + 360.0f * frameIndex / headless.frames;
+            pitch = -10.0f;
+            updateCamFront();
+        }
         if (gameOver) {
             // Clear with dark red background
             glClearColor(0.1f, 0.0f, 0.0f, 1.0f);
@@ -781,18 +2620,20 @@ int main() {
             float scale = 0.008f;   // Make text larger (was 0.005f)
             
             // Draw text in white color
-            drawTextShader(textShader, msg, x, y, scale, glm::vec3(1.0f, 1.0f, 1.0f));
+            queueText(msg, x, y, scale, glm::vec3(1.0f, 1.0f, 1.0f));
+            flushText(textShader);
             
             // Re-enable depth test
             glEnable(GL_DEPTH_TEST);
             
+            streamEndFrame(streamVertices);
             glfwSwapBuffers(window);
             glfwPollEvents();
             
             // Check for restart
             if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
                 gameOver = false;
-                camPos = glm::vec3((1-7)*1.5f, 1.6f, (1-7)*1.5f);
+                camPos = prevCamPos = glm::vec3((1-7)*1.5f, 1.6f, (1-7)*1.5f);
                 camYVelocity = 0.0f;
                 isJumping = false;
                 spawnEnemies();
@@ -800,101 +2641,55 @@ int main() {
             
             continue;
         }
-        float currentFrame = (float)glfwGetTime();
+        float currentFrame = (float)nowSeconds();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-
-        
-
-        // Update bullets
-        for (auto& b : bullets) {
-            if (!b.alive) continue;
-            b.pos += b.dir * b.speed * deltaTime;
-            // Remove bullet if too far
-            if (glm::length(b.pos - camPos) > 50.0f) b.alive = false;
-
-            // Check collision with enemies
-            for (auto& e : enemies) {
-                if (!e.alive || e.smashing) continue;
-                glm::vec3 enemyWorld = glm::vec3(e.pos.x * 1.5f - 10.5f, e.pos.y, e.pos.z * 1.5f - 10.5f);
-                float dist = glm::distance(glm::vec3(b.pos.x, 1.0f, b.pos.z), glm::vec3(enemyWorld.x, 1.0f, enemyWorld.z));
-                if (dist < 0.35f) { // Adjust threshold as needed
-                    e.smashing = true;
-                    e.smashTime = 0.0f;
-                    b.alive = false;
-                }
-            }
-        }
-
-        // Gravity and jump
-        const float gravity = -15.0f;
-        float groundY = 1.6f;
-        if (isJumping) {
-            camYVelocity += gravity * deltaTime;
-            camPos.y += camYVelocity * deltaTime;
-            if (camPos.y <= groundY) {
-                camPos.y = groundY;
-                camYVelocity = 0.0f;
-                isJumping = false;
-            }
-        }
-        // Prevent player from going below ground even if not jumping
-        if (camPos.y < groundY) camPos.y = groundY;
+        if (headless.enabled) deltaTime = 1.0f / 60.0f; // reproducible simulation
 
         // Mouse shooting (one shot per click)
-        bool mousePressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        bool mousePressed = window && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
         if (mousePressed && !prevMousePressed) {
             shoot();
         }
         prevMousePressed = mousePressed;
-        
-        for (auto& e : enemies) {
-            if (!e.alive) continue;
-            if (e.smashing) {
-                e.smashTime += deltaTime;
-                if (e.smashTime > 0.5f) { // Animation lasts 0.5s
-                    e.alive = false;
-                    e.smashing = false;
-                }
-                continue; // Don't move while smashing
-            }
-            anyAlive = true;
-            // Move in grid coordinates
-            glm::vec3 next = glm::vec3(e.pos.x, e.pos.y, e.pos.z) + e.velocity * deltaTime;
-            int ex = int(std::round(next.x)), ez = int(std::round(next.z));
-            if (ex >= 0 && ex < MAZE_W && ez >= 0 && ez < MAZE_H && maze[ez][ex] == 0) {
-                e.pos.x = next.x;
-                e.pos.z = next.z;
-            } else {
-                // Bounce and randomize direction a bit
-                e.velocity.x = -e.velocity.x + ((rand()%100)/100.0f-0.5f)*0.25f;
-                e.velocity.z = -e.velocity.z + ((rand()%100)/100.0f-0.5f)*0.25f;
-            }
 
-            // Check collision with player
-            glm::vec3 enemyWorld = glm::vec3(e.pos.x * 1.5f - 10.5f, e.pos.y, e.pos.z * 1.5f - 10.5f);
-            float dist = glm::distance(glm::vec3(camPos.x, 1.0f, camPos.z), glm::vec3(enemyWorld.x, 1.0f, enemyWorld.z));
-            if (dist < 0.4f) { // Adjust threshold as needed
-                gameOver = true;
-            }
+        // Fixed-rate simulation: whole ticks consume the accumulated frame time
+        // and rendering interpolates between the last two ticks
+        const float tickDt = 1.0f / simRate;
+        simAccumulator += std::min(deltaTime, MAX_FRAME_TIME);
+        while (simAccumulator >= tickDt && !gameOver) {
+            stepSimulation(tickDt);
+            simAccumulator -= tickDt;
         }
+        const float alpha = simAccumulator / tickDt;
+        const glm::vec3 eyePos = glm::mix(prevCamPos, camPos, alpha);
+        const float renderTime = simTime - (1.0f - alpha) * tickDt;
         anyAlive = false;
-        glClearColor(0.2f, 0.3f, 0.4f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        gpuBeginFrame(gpuProfiler);
         
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
+    int width = headless.width, height = headless.height;
+    if (window) glfwGetFramebufferSize(window, &width, &height);
+        GLuint outputFBO = headless.enabled ? headlessTarget.fbo : 0;
+        int sceneWidth = width, sceneHeight = height;
+        if (params.dynamicResolution) {
+            updateDynamicResolution(dynRes, gpuProfiler);
+            beginScaledScene(dynRes, width, height, sceneWidth, sceneHeight);
+        }
     // Ensure viewport uses the framebuffer size (important on HiDPI displays)
-    glViewport(0, 0, width, height);
+    glViewport(0, 0, sceneWidth, sceneHeight);
+        glClearColor(0.2f, 0.3f, 0.4f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         float aspect = (float)width / (float)height;
 
         glm::mat4 projection = glm::perspective(glm::radians(70.0f), aspect, 0.1f, 100.0f);
-        glm::mat4 view = glm::lookAt(camPos, camPos + camFront, camUp);
+        glm::mat4 view = glm::lookAt(eyePos, eyePos + camFront, camUp);
+        FrameUniforms frame = { projection, view, renderTime, {} };
+        glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
         // Draw floor
-        glm::mat4 model = glm::mat4(1.0f);
-        glm::mat4 mvp = projection * view * model;
-        drawObject(floorVAO, shader, 6, mvp, glm::vec3(0.3f, 0.7f, 0.3f), floorTexture);
+        queueDraw(renderQueue, PASS_FLOOR, shader, floorMesh, glm::mat4(1.0f), glm::vec3(0.3f, 0.7f, 0.3f), LAYER_FLOOR);
 
         glEnable(GL_DEPTH_TEST);
         // if (!anyAlive) {
@@ -914,74 +2709,239 @@ int main() {
         //     glfwPollEvents();
         //     continue;
         // }
-        // Draw maze walls
-        for (auto& pos : wallPositions) {
-            glm::mat4 model = glm::translate(glm::mat4(1.0f), pos) *
-                              glm::scale(glm::mat4(2.0f), glm::vec3(1.5f, 2.0f, 1.5f)); // 2.0f = taller, 1.5f = wider path
-            glm::mat4 mvp = projection * view * model;
-            drawObject(cubeVAO, shader, 36, mvp, glm::vec3(0.5f,0.5f,0.5f), wallTexture);
+        Frustum frustum = extractFrustum(projection * view);
+        cullStats = CullStats();
+
+        // PVS applies while the eye is inside an open cell and below the wall tops
+        int viewX = worldToCell(eyePos.x), viewZ = worldToCell(eyePos.z);
+        int viewCell = -1;
+        if (viewX >= 0 && viewX < MAZE_W && viewZ >= 0 && viewZ < MAZE_H && maze[viewZ][viewX] == 0 && eyePos.y < WALL_HEIGHT)
+            viewCell = viewZ * MAZE_W + viewX;
+        if (viewX >= 0 && viewX < MAZE_W && viewZ >= 0 && viewZ < MAZE_H && maze[viewZ][viewX] == 0)
+            updateMazeDistances(viewZ * MAZE_W + viewX);
+
+        // Draw maze walls: reject whole block rows first, then single blocks.
+        // Adjacent visible blocks are merged into one range by the queue.
+        for (int bz = 0; bz < BLOCKS_Z; ++bz) {
+            bool rowVisible = aabbInFrustum(frustum, mazeMesh.rowMin[bz], mazeMesh.rowMax[bz]);
+            for (int bx = 0; bx < BLOCKS_X; ++bx) {
+                const MazeBlock& block = mazeMesh.blocks[bz * BLOCKS_X + bx];
+                if (block.indexCount == 0) continue;
+                cullStats.wallBlocks++;
+                if (viewCell >= 0 && !pvsBlocks[viewCell][bz * BLOCKS_X + bx]) {
+                    cullStats.wallBlocksHidden++;
+                    continue;
+                }
+                if (!rowVisible || !aabbInFrustum(frustum, block.boundsMin, block.boundsMax)) {
+                    cullStats.wallBlocksCulled++;
+                    continue;
+                }
+                Mesh blockMesh = mazeMesh.mesh;
+                blockMesh.firstIndex = block.firstIndex;
+                blockMesh.indexCount = block.indexCount;
+                queueDraw(renderQueue, PASS_WALLS, shader, blockMesh,
+                          glm::mat4(1.0f), glm::vec3(0.5f,0.5f,0.5f), LAYER_WALL, 0,
+                          (uint32_t)blockDistance[bz * BLOCKS_X + bx]);
+            }
         }
 
-        // Draw enemies
-        for (auto& e : enemies) {
-            if (!e.alive) continue;
-            glm::vec3 color = glm::vec3(1,0,0);
-            float smashScaleY = 0.35f;
-            float smashAlpha = 1.0f;
-            if (e.smashing) {
-                float t = e.smashTime / 0.5f;
-                smashScaleY = 0.35f * (1.0f - t); // Shrink Y
-                smashAlpha = 1.0f - t;            // Fade out
+        // Enemies: cull on the CPU, stream the visible indices for one instanced draw.
+        // Walking the cell bins keeps each cell's enemies contiguous for the occlusion runs.
+        syncEnemyInstances(enemyInstances);
+        static std::vector<GLuint> enemyIndices;
+        static std::vector<EnemyRun> enemyRuns;
+        enemyIndices.clear();
+        enemyRuns.clear();
+        for (int c = 0; c < MAZE_CELLS; ++c) {
+            const GLuint runFirst = GLuint(enemyIndices.size());
+            for (int k = enemyGrid.cellStart[c]; k < enemyGrid.cellStart[c + 1]; ++k) {
+                const int i = enemyGrid.indices[k];
+                if (enemies.state[i] == ENEMY_DEAD) continue;
+                glm::vec3 enemyWorld = gridToWorld(enemies.x[i], ENEMY_Y, enemies.z[i]);
+                cullStats.enemies++;
+                if (viewCell >= 0 && !pvsVisible(viewCell, enemies.x[i], enemies.z[i], 0.175f / CELL_SIZE)) {
+                    cullStats.enemiesHidden++;
+                    continue;
+                }
+                if (!aabbInFrustum(frustum, enemyWorld - glm::vec3(0.175f), enemyWorld + glm::vec3(0.175f))) {
+                    cullStats.enemiesCulled++;
+                    continue;
+                }
+                enemyIndices.push_back(GLuint(i));
+            }
+            if (enemyIndices.size() > runFirst)
+                enemyRuns.push_back({ c, runFirst, GLuint(enemyIndices.size()) - runFirst });
+        }
+        GLintptr enemyOffset;
+        const GLsizeiptr enemyBytes = enemyIndices.size() * sizeof(GLuint);
+        bool drawEnemies = false;
+        if (void* dst = streamAlloc(streamVertices, enemyBytes, sizeof(GLuint), enemyOffset)) {
+            memcpy(dst, enemyIndices.data(), enemyBytes);
+            streamUnmap(streamVertices);
+            glBindVertexArray(staticGeometry.vao);
+            glBindBuffer(GL_ARRAY_BUFFER, streamVertices.buffer);
+            glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)enemyOffset);
+            glEnableVertexAttribArray(3);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            drawEnemies = true;
+        }
+
+        // Bullets: visible positions go to the stream buffer, drawn in one instanced call
+        static std::vector<glm::vec3> bulletInstances;
+        bulletInstances.clear();
+        for (size_t i = 0; i < bullets.count; ++i) {
+            const Bullet& b = bullets.items[i];
+            cullStats.bullets++;
+            glm::vec3 bulletPos = glm::mix(b.prevPos, b.pos, alpha);
+            if (!aabbInFrustum(frustum, bulletPos - glm::vec3(0.04f), bulletPos + glm::vec3(0.04f))) {
+                cullStats.bulletsCulled++;
+                continue;
+            }
+            bulletInstances.push_back(bulletPos);
+        }
+        GLintptr bulletOffset;
+        const GLsizeiptr bulletBytes = bulletInstances.size() * sizeof(glm::vec3);
+        if (void* dst = streamAlloc(streamVertices, bulletBytes, sizeof(glm::vec3), bulletOffset)) {
+            memcpy(dst, bulletInstances.data(), bulletBytes);
+            streamUnmap(streamVertices);
+            glBindVertexArray(staticGeometry.vao);
+            glBindBuffer(GL_ARRAY_BUFFER, streamVertices.buffer);
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)bulletOffset);
+            glEnableVertexAttribArray(2);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            queueDraw(renderQueue, PASS_BULLETS, instancedShader, cubeMesh,
+                      glm::scale(glm::mat4(1.0f), glm::vec3(0.08f)), glm::vec3(1,1,0), LAYER_NONE,
+                      (GLsizei)bulletInstances.size());
+        }
+
+        flushRenderQueue(renderQueue, sceneTextures, params.depthPrepass ? &depthShader : nullptr);
+
+        // Sky last among 3D passes: at depth 1.0 it only passes where nothing was drawn
+        gpuBeginPass(gpuProfiler, PASS_SKY);
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+        glUseProgram(skyShader.id);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, skyCubemap);
+        glBindVertexArray(cubeMesh.vao);
+        drawMesh(cubeMesh);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+
+        // Smashed enemies fade out, so they blend over everything opaque including the sky
+        if (drawEnemies) {
+            gpuBeginPass(gpuProfiler, PASS_ENEMIES);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glUseProgram(enemyShader.id);
+            glUniform1i(enemyShader.loc[U_LAYER], LAYER_ENEMY);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, sceneTextures);
+            glActiveTexture(GL_TEXTURE0 + ENEMY_STATE_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, enemyInstances.texture);
+            glBindVertexArray(cubeMesh.vao);
+            const void* cubeFirstIndex = (const void*)(cubeMesh.firstIndex * sizeof(unsigned int));
+            if (!params.occlusionQueries) {
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, cubeMesh.indexCount, GL_UNSIGNED_INT, cubeFirstIndex,
+                                                  (GLsizei)enemyIndices.size(), cubeMesh.baseVertex);
+            } else {
+                CellOcclusion& occ = cellOcclusion;
+                const uint64_t frame = ++occ.frame;
+                const int current = int(frame % 2), previous = current ^ 1;
+                // The box covers the cell plus an enemy's half-size and a little
+                // slack for the GPU extrapolating positions between ticks
+                const float half = CELL_SIZE * 0.5f + 0.175f + 0.1f, halfY = 0.175f + 0.1f;
+                auto eyeInBox = [&](const glm::vec3& center) {
+                    glm::vec3 d = glm::abs(eyePos - center);
+                    return d.x < half + 0.2f && d.z < half + 0.2f && d.y < halfY + 0.2f; // 0.2 > near plane
+                };
+                // Test each cell's box against the walls and floor already in the depth buffer
+                glDisable(GL_BLEND);
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                glDepthMask(GL_FALSE);
+                glUseProgram(depthShader.id);
+                for (const EnemyRun& run : enemyRuns) {
+                    glm::vec3 center = gridToWorld(float(run.cell % MAZE_W), ENEMY_Y, float(run.cell / MAZE_W));
+                    if (eyeInBox(center)) continue; // the box would be clipped by the near plane
+                    glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), center), glm::vec3(half, halfY, half) * 2.0f);
+                    glUniformMatrix4fv(depthShader.loc[U_MODEL], 1, GL_FALSE, &model[0][0]);
+                    const int slot = run.cell * 2 + current;
+                    glBeginQuery(GL_ANY_SAMPLES_PASSED, occ.queries[slot]);
+                    drawMesh(cubeMesh);
+                    glEndQuery(GL_ANY_SAMPLES_PASSED);
+                    occ.issuedFrame[slot] = frame;
+                }
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glDepthMask(GL_TRUE);
+                glEnable(GL_BLEND);
+                glUseProgram(enemyShader.id);
+                // One instanced draw per cell, conditioned on last frame's result.
+                // GL 3.3 has no base instance, so the index attribute is re-pointed
+                // at the run. Cells not tested last frame draw unconditionally.
+                glBindBuffer(GL_ARRAY_BUFFER, streamVertices.buffer);
+                for (const EnemyRun& run : enemyRuns) {
+                    const int slot = run.cell * 2 + previous;
+                    bool conditional = occ.issuedFrame[slot] == frame - 1;
+                    glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)(enemyOffset + run.first * sizeof(GLuint)));
+                    if (conditional) glBeginConditionalRender(occ.queries[slot], GL_QUERY_NO_WAIT);
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, cubeMesh.indexCount, GL_UNSIGNED_INT, cubeFirstIndex,
+                                                      (GLsizei)run.count, cubeMesh.baseVertex);
+                    if (conditional) glEndConditionalRender();
+                }
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
             }
-            glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(e.pos.x * 1.5f - 10.5f, e.pos.y, e.pos.z * 1.5f - 10.5f)) *
-                            glm::scale(glm::mat4(1.0f), glm::vec3(0.35f, smashScaleY, 0.35f));
-            glm::mat4 mvp = projection * view * model;
-            // If you want to pass alpha, modify your shader to accept it, or just use color for now
-            drawObject(cubeVAO, shader, 36, mvp, color, enemyTexture);
+            glBindVertexArray(0);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            glDisable(GL_BLEND);
         }
 
-        for (auto& b : bullets) {
-            if (!b.alive) continue;
-            glm::mat4 model = glm::translate(glm::mat4(1.0f), b.pos) *
-                            glm::scale(glm::mat4(1.0f), glm::vec3(0.08f, 0.08f, 0.08f));
-            glm::mat4 mvp = projection * view * model;
-            drawObject(cubeVAO, shader, 36, mvp, glm::vec3(1,1,0));
+        if (params.dynamicResolution) {
+            gpuBeginPass(gpuProfiler, PASS_UPSCALE);
+            upscaleScene(dynRes, outputFBO, sceneWidth, sceneHeight, width, height);
         }
 
         // Draw a hand with gun (bigger gun quad, offset to lower right)
+        gpuBeginPass(gpuProfiler, PASS_HUD);
         glDisable(GL_DEPTH_TEST);
         glm::mat4 handModel = glm::translate(glm::mat4(1.0f), glm::vec3(0.3f, -0.3f, 0.0f)) *
                               glm::scale(glm::mat4(1.0f), glm::vec3(2.8f, 2.0f, 1.0f));
-        glm::mat4 handMVP = handModel; // NDC
-        drawObject(gunVAO, shader, 6, handMVP, glm::vec3(0.4f, 0.3f, 0.2f));
-        glEnable(GL_DEPTH_TEST);
+        drawObject(gunMesh, hudShader, handModel, glm::vec3(0.4f, 0.3f, 0.2f)); // NDC
 
         // Draw a crosshair in the center of the screen
-        glUseProgram(shader);
-        glUniformMatrix4fv(glGetUniformLocation(shader, "uMVP"), 1, GL_FALSE, &glm::mat4(1.0f)[0][0]);
-        glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, &glm::vec3(1,1,1)[0]);
-        glUniform1i(glGetUniformLocation(shader, "useTex"), 0);
-        glBindVertexArray(crossVAO);
-        glDrawArrays(GL_LINES, 0, 2);
-        glDrawArrays(GL_LINES, 2, 2);
-        glBindVertexArray(0);
-
-                // Disable depth writing so sky is always in the background
-        glDepthMask(GL_FALSE);
+        drawObject(crossMesh, hudShader, glm::mat4(1.0f), glm::vec3(1,1,1), LAYER_NONE, GL_LINES);
+        glEnable(GL_DEPTH_TEST);
 
-        // Center skybox at camera, scale large (e.g., 50 units)
-        glm::mat4 skyModel = glm::translate(glm::mat4(1.0f), camPos) *
-                            glm::scale(glm::mat4(1.0f), glm::vec3(50.0f));
-
-        // Remove translation from view matrix so skybox doesn't move with camera position
-        glm::mat4 skyView = glm::mat4(glm::mat3(view));
-        glm::mat4 skyMVP = projection * skyView * skyModel;
-        glCullFace(GL_FRONT);
-        // Draw with sky texture (use your cube VAO)
-        drawObject(cubeVAO, shader, 36, skyMVP, glm::vec3(1.0f), skyTexture);
-        glCullFace(GL_BACK);
-        // Re-enable depth writing
-        glDepthMask(GL_TRUE);
+        // Debug overlay (TAB toggles)
+        if (params.showDebug) {
+            char stats[200];
+            snprintf(stats, sizeof(stats), "culled: walls %d/%d  enemies %d/%d  bullets %d/%d   pvs hidden: walls %d  enemies %d   draws %d  binds %d",
+                     cullStats.wallBlocksCulled, cullStats.wallBlocks,
+                     cullStats.enemiesCulled, cullStats.enemies,
+                     cullStats.bulletsCulled, cullStats.bullets,
+                     cullStats.wallBlocksHidden, cullStats.enemiesHidden,
+                     renderQueue.drawCalls, renderQueue.stateChanges);
+            queueText(stats, -0.98f, 0.95f, 0.004f, glm::vec3(1.0f));
+
+            char gpuStats[200];
+            int len = snprintf(gpuStats, sizeof(gpuStats), "gpu ms:");
+            for (int pass = 0; pass < PASS_COUNT && len < (int)sizeof(gpuStats); ++pass)
+                len += snprintf(gpuStats + len, sizeof(gpuStats) - len, "  %s %.2f", gpuPassNames[pass], gpuProfiler.passMs[pass]);
+            queueText(gpuStats, -0.98f, 0.91f, 0.004f, glm::vec3(1.0f));
+
+            if (params.dynamicResolution) {
+                char resStats[80];
+                snprintf(resStats, sizeof(resStats), "scene %dx%d (%.0f%%)", sceneWidth, sceneHeight, dynRes.scale * 100.0f);
+                queueText(resStats, -0.98f, 0.87f, 0.004f, glm::vec3(1.0f));
+            }
+        }
+        flushText(textShader);
+        gpuEndFrame(gpuProfiler);
 
 
 
@@ -1015,23 +2975,34 @@ int main() {
             // glClear(GL_COLOR_BUFFER_BIT);
             // ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-        glfwSwapBuffers(window);
-        // glfwSwapBuffers(imguiWindow);
-        glfwPollEvents();
+        streamEndFrame(streamVertices);
+        if (window) {
+            glfwSwapBuffers(window);
+            // glfwSwapBuffers(imguiWindow);
+            glfwPollEvents();
+        } else {
+            glFinish(); // count the whole frame, not just command submission
+            frameMs.push_back((nowSeconds() - frameStart) * 1000.0);
+            frameIndex++;
+        }
     }
-
-    glDeleteVertexArrays(1, &cubeVAO);
-    glDeleteBuffers(1, &cubeVBO);
-    glDeleteBuffers(1, &cubeEBO);
-    glDeleteVertexArrays(1, &floorVAO);
-    glDeleteBuffers(1, &floorVBO);
-    glDeleteBuffers(1, &floorEBO);
-    glDeleteVertexArrays(1, &gunVAO);
-    glDeleteBuffers(1, &gunVBO);
-    glDeleteBuffers(1, &gunEBO);
-    glDeleteVertexArrays(1, &crossVAO);
-    glDeleteBuffers(1, &crossVBO);
-    glDeleteProgram(shader);
+    if (headless.enabled) printFrameStats(frameMs);
+
+    destroyGeometry(staticGeometry);
+    destroyTextBatch(textBatch);
+    destroyStreamBuffer(streamVertices);
+    destroyEnemyInstances(enemyInstances);
+    destroyCellOcclusion(cellOcclusion);
+    glDeleteBuffers(1, &frameUBO);
+    destroyGpuProfiler(gpuProfiler);
+    destroyRenderTarget(dynRes.target);
+    glDeleteProgram(shader.id);
+    glDeleteProgram(hudShader.id);
+    glDeleteProgram(instancedShader.id);
+    glDeleteProgram(depthShader.id);
+    glDeleteProgram(enemyShader.id);
+    glDeleteProgram(skyShader.id);
+    glDeleteProgram(textShader.id);
 
 //     ImGui_ImplOpenGL3_Shutdown();
 // ImGui_ImplGlfw_Shutdown();
@@ -1039,8 +3010,14 @@ int main() {
 
 
 // glfwDestroyWindow(imguiWindow);
-    glfwDestroyWindow(window);
-
-    glfwTerminate();
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    } else {
+        destroyRenderTarget(headlessTarget);
+#ifdef HAVE_EGL
+        destroyHeadlessContext(headlessContext);
+#endif
+    }
     return 0;
 }
\ No newline at end of file